@@ -0,0 +1,202 @@
+/**
+ * Concurrent HashTable Throughput Benchmark
+ * (C) 2013 Christian Gunderman
+ *
+ * Runs a mix of gets and puts from several threads against a CHT and
+ * against a plain HT behind one global mutex, and prints operations per
+ * second for each. Usage:
+ *
+ *   cht_bench [threads] [read percent] [keys] [ops per thread] [stripes]
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "../include/ht.h"
+#include "../include/cht.h"
+
+#define MAX_THREADS 256
+
+/* benchmark settings */
+static int numThreads = 4;
+static int readPercent = 90;
+static int numKeys = 1 << 20;
+static int opsPerThread = 2000000;
+static int numStripes = 0;
+
+/* tables under test */
+static CHT * cht;
+static HT * ht;
+static pthread_mutex_t htLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* per-thread random state and result */
+typedef struct Worker {
+  pthread_t thread;
+  unsigned int seed;
+  int hits;
+} Worker;
+
+/**
+ * Small xorshift generator so threads don't share rand()'s state.
+ */
+static unsigned int next_rand(unsigned int * seed) {
+  unsigned int x = *seed;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *seed = x;
+  return x;
+}
+
+/**
+ * Gets the current time in seconds.
+ */
+static double now() {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/**
+ * Worker loop for the concurrent table.
+ */
+static void * run_cht(void * arg) {
+  Worker * worker = (Worker*)arg;
+  DSValue value;
+  int i;
+
+  for(i = 0; i < opsPerThread; i++) {
+    unsigned int r = next_rand(&worker->seed);
+    int key = (int)(r % (unsigned int)numKeys);
+
+    if((int)((r >> 8) % 100) < readPercent) {
+      worker->hits += cht_get(cht, &key, sizeof(int), &value);
+    } else {
+      value.intVal = i;
+      cht_put(cht, &key, sizeof(int), &value, NULL, NULL);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Worker loop for the global mutex baseline.
+ */
+static void * run_locked_ht(void * arg) {
+  Worker * worker = (Worker*)arg;
+  DSValue value;
+  int i;
+
+  for(i = 0; i < opsPerThread; i++) {
+    unsigned int r = next_rand(&worker->seed);
+    int key = (int)(r % (unsigned int)numKeys);
+
+    pthread_mutex_lock(&htLock);
+    if((int)((r >> 8) % 100) < readPercent) {
+      worker->hits += ht_get_raw_key(ht, &key, sizeof(int), &value);
+    } else {
+      value.intVal = i;
+      ht_put_raw_key(ht, &key, sizeof(int), &value, NULL, NULL);
+    }
+    pthread_mutex_unlock(&htLock);
+  }
+
+  return NULL;
+}
+
+/**
+ * Runs one worker function on every thread.
+ * returns: the elapsed time, in seconds.
+ */
+static double run_threads(void * (*func)(void *), Worker * workers) {
+  double start = now();
+  int i;
+
+  for(i = 0; i < numThreads; i++) {
+    workers[i].seed = 2463534242u + i * 7919;
+    workers[i].hits = 0;
+    pthread_create(&workers[i].thread, NULL, func, &workers[i]);
+  }
+  for(i = 0; i < numThreads; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+
+  return now() - start;
+}
+
+/**
+ * Prints one result line.
+ */
+static void report(const char * name, double seconds) {
+  double ops = (double)numThreads * opsPerThread;
+
+  printf("%-14s %8.3fs %12.0f ops/s\n", name, seconds, ops / seconds);
+}
+
+int main(int argc, char ** argv) {
+  Worker workers[MAX_THREADS];
+  DSValue value;
+  int key;
+
+  if(argc > 1) numThreads = atoi(argv[1]);
+  if(argc > 2) readPercent = atoi(argv[2]);
+  if(argc > 3) numKeys = atoi(argv[3]);
+  if(argc > 4) opsPerThread = atoi(argv[4]);
+  if(argc > 5) numStripes = atoi(argv[5]);
+
+  if(numThreads < 1 || numThreads > MAX_THREADS || numKeys < 1) {
+    fprintf(stderr, "usage: %s [threads] [read percent] [keys] "
+	    "[ops per thread] [stripes]\n", argv[0]);
+    return 1;
+  }
+
+  /* 16 stripes per thread unless told otherwise */
+  if(numStripes < 1) {
+    numStripes = numThreads * 16;
+  }
+
+  cht = cht_new(16, numStripes, 0.75f);
+  ht = ht_new(16, 16, 0.75f);
+  if(cht == NULL || ht == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  /* prefill half of the keys so gets see a mix of hits and misses */
+  for(key = 0; key < numKeys; key += 2) {
+    value.intVal = key;
+    cht_put(cht, &key, sizeof(int), &value, NULL, NULL);
+    ht_put_raw_key(ht, &key, sizeof(int), &value, NULL, NULL);
+  }
+
+  printf("%d threads, %d%% reads, %d keys, %d ops per thread, "
+	 "%d stripes\n", numThreads, readPercent, numKeys, opsPerThread,
+	 numStripes);
+  report("cht", run_threads(run_cht, workers));
+  report("ht + mutex", run_threads(run_locked_ht, workers));
+
+  cht_free(cht);
+  ht_free(ht);
+  return 0;
+}
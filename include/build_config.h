@@ -38,6 +38,40 @@
 #define DATASTRUCT_ENABLE_CHAR
 #define DATASTRUCT_ENABLE_POINTER
 
+/* Statistics:
+ * Define DATASTRUCT_ENABLE_STATS, here or with -D for the library and its
+ * users alike, to have each hashtable count its lookups, chain walks and
+ * rehashes, see ht_stats(). When it is not defined the counters don't
+ * exist, so they cost nothing.
+ */
+/* #define DATASTRUCT_ENABLE_STATS */
+
+/* Lock-free reads:
+ * DATASTRUCT_ENABLE_EBR builds ebr.c and the hashtable's lock-free read
+ * mode, see HTOptions.ebr. Both need the GCC __atomic builtins and
+ * pthreads, so it is only defined for GCC compatible compilers. Without
+ * it, ht_new_ex() refuses options->ebr and ht.c uses no EBR functions.
+ */
+#ifdef __GNUC__
+#define DATASTRUCT_ENABLE_EBR
+#endif /* __GNUC__ */
+
+/* Memory mapped snapshots:
+ * DATASTRUCT_ENABLE_MMAP builds ht_save() and ht_open_mmap(), see
+ * ht_mmap.c. They need POSIX open(), fstat() and mmap(), so it is only
+ * defined on POSIX systems. Without it, ht_mmap.c compiles to nothing.
+ */
+#if defined(__unix__) || defined(__APPLE__)
+#define DATASTRUCT_ENABLE_MMAP
+#endif /* __unix__ || __APPLE__ */
+
+/* Threads:
+ * Define DATASTRUCT_ENABLE_THREADS to let ht_from_arrays() and
+ * set_from_array() split their work across pthreads. Programs then link
+ * with -lpthread. Without it, bulk builds run on the calling thread.
+ */
+/* #define DATASTRUCT_ENABLE_THREADS */
+
 /* Boolean Definitions:
  * Some compilers don't come with stdbool.h, so we go ahead and define our own
  * for this project.
@@ -0,0 +1,51 @@
+/**
+ * Lock Striped Concurrent HashTable
+ * (C) 2013 Christian Gunderman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#ifndef CHT__H__
+#define CHT__H__
+
+#include <stdlib.h>
+#include <string.h>
+#include "build_config.h"
+#include "ht.h"
+
+/* Concurrent HashTable structure definition */
+typedef struct CHT {
+  HTNode ** table;
+  int tableSize;       /* always a power of two */
+  float loadFactor;
+  int numStripes;      /* power of two, never more than tableSize */
+  void * stripes;      /* CHTStripe array, see cht.c */
+} CHT;
+
+CHT * cht_new(int tableSize, int numStripes, float loadFactor);
+
+bool cht_put(CHT * cht, void * key, size_t keySize,
+	     DSValue * newValue, DSValue * oldValue, bool * prevValue);
+
+bool cht_get(CHT * cht, void * key, size_t keySize, DSValue * value);
+
+bool cht_remove(CHT * cht, void * key, size_t keySize, DSValue * oldValue);
+
+int cht_size(CHT * cht);
+
+void cht_free(CHT * cht);
+
+#endif /* CHT__H__ */
@@ -0,0 +1,74 @@
+/**
+ * Epoch Based Reclamation
+ * (C) 2013 Christian Gunderman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#ifndef EBR__H__
+#define EBR__H__
+
+#include <stdlib.h>
+#include "build_config.h"
+
+/* Frees a retired pointer once no reader can reach it */
+typedef void (*EBRFreeFunc)(void * ptr);
+
+/* Per-thread reader record, returned by ebr_register() */
+typedef struct EBRThread {
+  struct EBRThread * next;
+  struct EBR * owner;
+  unsigned long state;   /* (epoch << 1) | 1 while inside a read section */
+  int inUse;
+} EBRThread;
+
+/* A retired pointer waiting for its epoch to pass */
+typedef struct EBRRetired {
+  struct EBRRetired * next;
+  void * ptr;
+  EBRFreeFunc freeFunc;
+} EBRRetired;
+
+/* Reclamation domain shared by a set of readers and writers */
+typedef struct EBR {
+  unsigned long epoch;
+  EBRThread * threads;
+  EBRRetired * limbo[3];   /* retired in epoch e go in limbo[e % 3] */
+  int numRetired;
+  void * lock;             /* pthread_mutex_t, see ebr.c */
+} EBR;
+
+#ifdef DATASTRUCT_ENABLE_EBR
+EBR * ebr_new();
+
+EBRThread * ebr_register(EBR * ebr);
+
+void ebr_unregister(EBRThread * thread);
+
+void ebr_enter(EBRThread * thread);
+
+void ebr_exit(EBRThread * thread);
+
+void ebr_retire(EBR * ebr, void * ptr, EBRFreeFunc freeFunc);
+
+bool ebr_collect(EBR * ebr);
+
+void ebr_synchronize(EBR * ebr);
+
+void ebr_free(EBR * ebr);
+#endif /* DATASTRUCT_ENABLE_EBR */
+
+#endif /* EBR__H__ */
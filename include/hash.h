@@ -0,0 +1,40 @@
+/**
+ * Hash Functions
+ * (C) 2013 Christian Gunderman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#ifndef HASH__H__
+#define HASH__H__
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/* Hashes keySize bytes of key. Equal keys and seeds must give equal
+ * hashes. Tables use the low bits for indexing, so they must be well mixed.
+ */
+typedef uint32_t (*HashFunc)(const void * key, size_t keySize, uint32_t seed);
+
+uint32_t hash_lookup3(const void * key, size_t keySize, uint32_t seed);
+
+uint32_t hash_wy(const void * key, size_t keySize, uint32_t seed);
+
+uint32_t hash_crc32c(const void * key, size_t keySize, uint32_t seed);
+
+uint32_t hash_random_seed();
+
+#endif /* HASH__H__ */
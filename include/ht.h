@@ -21,18 +21,114 @@
 #ifndef HT__H__
 #define HT__H__
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include "build_config.h"
+#include "pool.h"
+#include "ebr.h"
+#include "hash.h"
 
-/* HashTable List Node */
+/* Longest key stored in a pooled node, see HTOptions.nodesPerSlab */
+#define HT_POOL_KEY_SIZE 24
+
+/* HashTable List Node. The node and its key are a single allocation: the
+ * keySize bytes of the key directly follow the struct, see HT_NODE_KEY.
+ */
 typedef struct HTNode {
-  void * key;
+  struct HTNode * next;
+  uint32_t hash;   /* full hash of key, checked before comparing keys */
   size_t keySize;
-  void * next;     /* HTNode* */
   DSValue value;
 }HTNode;
 
+/* Gets a pointer to the key stored after a node */
+#define HT_NODE_KEY(node) ((void*)((HTNode*)(node) + 1))
+
+/* HashTable storage engines, selected when the table is created */
+typedef enum HTEngine {
+  HT_ENGINE_CHAINED = 0,   /* separate chaining, the default */
+  HT_ENGINE_SWISS,         /* open addressing with SIMD probed tag bytes */
+  HT_ENGINE_ORDERED,       /* compact entry array, iterates in insertion
+			    * order */
+  HT_ENGINE_MAPPED,        /* read-only file image, see ht_open_mmap() */
+  HT_ENGINE_FROZEN,        /* read-only perfect hash, see ht_freeze() */
+  HT_ENGINE_CUCKOO         /* 4-way bucketized cuckoo hashing, at most two
+			    * buckets read per lookup */
+} HTEngine;
+
+/* Most buckets a chained table can have */
+#define HT_MAX_TABLE_SIZE (1 << 30)
+
+/* HashTable growth policy. Given the current table size and block size,
+ * returns the new number of buckets, which must be at least minSize, but
+ * no more than HT_MAX_TABLE_SIZE. If minSize is larger than that, return
+ * HT_MAX_TABLE_SIZE and the table refuses to grow.
+ */
+typedef int (*HTGrowthPolicy)(int tableSize, int blockSize, int minSize);
+
+/* Read-modify-write callback for ht_update(). value holds the key's
+ * current value, or zeroes if exists is false, and may be changed in place.
+ * Return true to keep the key with the new value, or false to remove it
+ * (or not insert it). Must not modify the table.
+ */
+typedef bool (*HTUpdateFunc)(DSValue * value, bool exists, void * context);
+
+/* Longest chain length counted on its own by HTStats.chainLengths */
+#define HT_STATS_MAX_CHAIN 8
+
+/* HashTable counters, kept when DATASTRUCT_ENABLE_STATS is defined */
+typedef struct HTCounters {
+  unsigned long lookups;       /* gets, and the hits and misses among them */
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long nodesVisited;  /* chain nodes walked, by any operation */
+  unsigned long keyCompares;   /* memcmp calls on keys with equal hashes */
+  unsigned long rehashes;
+  double rehashSeconds;        /* CPU time spent rehashing */
+} HTCounters;
+
+/* HashTable statistics, see ht_stats() */
+typedef struct HTStats {
+  HTCounters counters;
+  int numItems;
+  int tableSize;
+  int emptyBuckets;
+  int longestChain;
+  unsigned long chainLengths[HT_STATS_MAX_CHAIN + 1]; /* buckets holding
+						       * n nodes, the last
+						       * counting longer
+						       * chains too */
+  size_t bytesAllocated;       /* bucket arrays and nodes */
+} HTStats;
+
+/* HashTable creation options. Initialize with ht_options_init() so that
+ * fields added in the future get their defaults.
+ */
+typedef struct HTOptions {
+  HTEngine engine;
+  HTGrowthPolicy growthPolicy;  /* NULL for ht_growth_double */
+  int rehashStep;               /* buckets migrated per put/get when
+				 * rehashing incrementally, or 0 to
+				 * rehash all at once */
+  int nodesPerSlab;             /* if > 0, nodes with keys of up to
+				 * HT_POOL_KEY_SIZE bytes are carved from
+				 * slabs of this many nodes */
+  EBR * ebr;                    /* if set, gets take no locks and may run
+				 * concurrently with one writer, see
+				 * ht_new_ex() */
+  HashFunc hashFunc;            /* NULL for hash_lookup3 */
+  uint32_t hashSeed;            /* passed to hashFunc */
+  bool randomSeed;              /* if true, hashSeed is ignored and a
+				 * random seed is picked. No defense
+				 * against crafted keys with
+				 * hash_crc32c */
+  float shrinkFactor;           /* if > 0, a chained table shrinks when
+				 * removals drop its load below this. Keep
+				 * it well under loadFactor / 2 */
+} HTOptions;
+
 /* HashTable Structure definition */
 typedef struct HT {
   HTNode ** table;
@@ -40,6 +136,42 @@ typedef struct HT {
   int blockSize;
   float loadFactor;
   int numItems;
+  HTGrowthPolicy growthPolicy;
+  unsigned int indexMask;  /* tableSize - 1 when tableSize is a power of 2 */
+  HashFunc hashFunc;
+  uint32_t hashSeed;
+  float shrinkFactor;
+  int minTableSize;        /* never shrinks below its initial size */
+
+  /* incremental rehash state, oldTable is NULL when not rehashing */
+  int rehashStep;
+  HTNode ** oldTable;
+  int oldTableSize;
+  unsigned int oldIndexMask;
+  int rehashIndex;
+
+  /* node pool, and the number of nodes too large for it */
+  Pool * nodePool;
+  int heapNodes;
+
+  /* lock-free read mode: readers find the buckets through readView, and
+   * unlinked nodes and arrays are retired to ebr
+   */
+  EBR * ebr;
+  struct HTReadView * readView;
+
+  /* non-chained engines keep their own storage in engineData */
+  HTEngine engine;
+  const struct HTEngineOps * ops;
+  void * engineData;
+
+  /* key expiry times, see ht_set_expiry(). NULL until one is set */
+  struct HT * expires;
+  int expireCursor;        /* next expires bucket for ht_expire_step() */
+
+#ifdef DATASTRUCT_ENABLE_STATS
+  HTCounters counters;
+#endif /* DATASTRUCT_ENABLE_STATS */
 } HT;
 
 /* HT Iterator structure defintion */
@@ -48,10 +180,46 @@ typedef struct HTIter {
   int index;
   HTNode * prevNode;
   HTNode * currentNode;
+  bool removed;            /* shrink the table once iteration ends */
 } HTIter;
 
 HT * ht_new(int tableSize, int blockSize, float loadFactor);
 
+void ht_options_init(HTOptions * options);
+
+HT * ht_new_ex(int tableSize, int blockSize, float loadFactor,
+	       HTOptions * options);
+
+int ht_growth_double(int tableSize, int blockSize, int minSize);
+
+int ht_growth_linear(int tableSize, int blockSize, int minSize);
+
+bool ht_reserve(HT * ht, int numItems);
+
+bool ht_compact(HT * ht);
+
+#ifdef DATASTRUCT_ENABLE_MMAP
+bool ht_save(HT * ht, const char * path);
+
+HT * ht_open_mmap(const char * path);
+#endif /* DATASTRUCT_ENABLE_MMAP */
+
+bool ht_freeze(HT * ht);
+
+bool ht_stats(HT * ht, HTStats * stats);
+
+void ht_stats_reset(HT * ht);
+
+bool ht_stats_dump(HT * ht, FILE * file);
+
+#ifdef DATASTRUCT_ENABLE_LONG
+bool ht_set_expiry(HT * ht, void * key, size_t keySize, long when);
+
+long ht_get_expiry(HT * ht, void * key, size_t keySize);
+
+int ht_expire_step(HT * ht, int maxChecks);
+#endif /* DATASTRUCT_ENABLE_LONG */
+
 #ifdef DATASTRUCT_ENABLE_BOOL
 bool ht_put_bool(HT * ht, char * key, bool newValue, bool * oldValue, bool * prevValue);
 #endif /* DATASTRUCT_ENABLE_BOOL */
@@ -90,6 +258,30 @@ bool ht_put_raw_key(HT * ht, void * key, size_t keySize,
 
 bool ht_get_raw_key(HT * ht, void * key, size_t keySize, DSValue * value);
 
+uint32_t ht_hash(HT * ht, void * key, size_t keySize);
+
+bool ht_put_hashed(HT * ht, uint32_t hash, void * key, size_t keySize,
+		   DSValue * newValue, DSValue * oldValue, bool * prevValue);
+
+bool ht_get_hashed(HT * ht, uint32_t hash, void * key, size_t keySize,
+		   DSValue * value);
+
+DSValue * ht_get_or_insert(HT * ht, void * key, size_t keySize,
+			   bool * inserted);
+
+bool ht_update(HT * ht, void * key, size_t keySize, HTUpdateFunc update,
+	       void * context);
+
+int ht_get_many(HT * ht, void ** keys, size_t * keySizes, int count,
+		DSValue * values, bool * found);
+
+bool ht_put_many(HT * ht, void ** keys, size_t * keySizes,
+		 DSValue * newValues, int count);
+
+HT * ht_from_arrays(void ** keys, size_t * keySizes, DSValue * values,
+		    int count, float loadFactor, HTOptions * options,
+		    int numThreads);
+
 void ht_iter_get(HT * ht, HTIter * i);
 
 bool ht_iter_has_next(HTIter * i);
@@ -0,0 +1,133 @@
+/**
+ * HashTable Engine Internals
+ * (C) 2013 Christian Gunderman
+ *
+ * Shared between ht.c and the alternate storage engines. Not part of the
+ * public interface; include ht.h instead.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#ifndef HT_INTERNAL__H__
+#define HT_INTERNAL__H__
+
+#include <time.h>
+#include "ht.h"
+
+/* Number of keys hashed and prefetched together by the batch functions */
+#define HT_BATCH_GROUP 16
+
+/* Hints the CPU to start loading addr into cache */
+#ifdef __GNUC__
+#define HT_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define HT_PREFETCH(addr) ((void)(addr))
+#endif /* __GNUC__ */
+
+/* Hashes a key with the table's hash function and seed */
+#define HT_HASH(ht, key, keySize) \
+  ((ht)->hashFunc((key), (keySize), (ht)->hashSeed))
+
+/* Loads and stores that order node contents against the pointers that
+ * publish them, for tables read without locks
+ */
+#ifdef __GNUC__
+#define HT_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define HT_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define HT_LOAD_ACQUIRE(p) (*(p))
+#define HT_STORE_RELEASE(p, v) (*(p) = (v))
+#endif /* __GNUC__ */
+
+/* Statistics hooks, which compile to nothing unless DATASTRUCT_ENABLE_STATS
+ * is defined. Take HT_STAT_CLOCK() before a rehash and pass it to
+ * HT_STAT_REHASHED() once the rehash succeeds.
+ */
+#ifdef DATASTRUCT_ENABLE_STATS
+#define HT_STAT_ADD(ht, counter, n) ((ht)->counters.counter += (n))
+#define HT_STAT_CLOCK() clock()
+#define HT_STAT_REHASHED(ht, start) \
+  ((ht)->counters.rehashes++, (ht)->counters.rehashSeconds += \
+   (double)(clock() - (start)) / CLOCKS_PER_SEC)
+#else
+#define HT_STAT_ADD(ht, counter, n) ((void)0)
+#define HT_STAT_CLOCK() ((clock_t)0)
+#define HT_STAT_REHASHED(ht, start) ((void)(start))
+#endif /* DATASTRUCT_ENABLE_STATS */
+
+/* Operations table for a non-chained storage engine. ht.c forwards each
+ * public call here when ht->ops is set.
+ */
+typedef struct HTEngineOps {
+  bool (*init)(HT * ht, int tableSize);
+  bool (*put)(HT * ht, uint32_t hash, void * key, size_t keySize,
+	      DSValue * newValue, DSValue * oldValue, bool * prevValue);
+  bool (*get)(HT * ht, uint32_t hash, void * key, size_t keySize,
+	      DSValue * value);
+  DSValue * (*get_or_insert)(HT * ht, uint32_t hash, void * key,
+			     size_t keySize, bool * inserted);
+  bool (*reserve)(HT * ht, int numItems);
+  bool (*compact)(HT * ht);
+  void (*iter_get)(HT * ht, HTIter * i);
+  bool (*iter_has_next)(HTIter * i);
+  bool (*iter_next)(HTIter * i, void * keyBuffer, size_t keyBufferLen,
+		    DSValue * value, size_t * keyLen, bool remove);
+  void (*free)(HT * ht);
+} HTEngineOps;
+
+extern const HTEngineOps ht_swiss_ops;
+
+extern const HTEngineOps ht_ordered_ops;
+
+#ifdef DATASTRUCT_ENABLE_MMAP
+extern const HTEngineOps ht_mapped_ops;
+#endif /* DATASTRUCT_ENABLE_MMAP */
+
+extern const HTEngineOps ht_frozen_ops;
+
+extern const HTEngineOps ht_cuckoo_ops;
+
+/* Expiry hooks for ht.c, see ht_expire.c. Expiry times are stored as
+ * longs, so without DATASTRUCT_ENABLE_LONG no key can have one.
+ */
+#ifdef DATASTRUCT_ENABLE_LONG
+#define HT_HAS_EXPIRIES(ht) ((ht)->expires != NULL \
+			     && (ht)->expires->numItems > 0)
+
+bool ht_expire_if_due(HT * ht, uint32_t hash, void * key, size_t keySize);
+
+void ht_expire_forget(HT * ht, uint32_t hash, void * key, size_t keySize);
+#else
+#define HT_HAS_EXPIRIES(ht) false
+#define ht_expire_if_due(ht, hash, key, keySize) false
+#define ht_expire_forget(ht, hash, key, keySize) ((void)0)
+#endif /* DATASTRUCT_ENABLE_LONG */
+
+/* Without DATASTRUCT_ENABLE_EBR, ht_new_ex() refuses options->ebr, so
+ * ht->ebr is always NULL and the lock-free read paths never run.
+ */
+#ifndef DATASTRUCT_ENABLE_EBR
+#define ebr_retire(ebr, ptr, freeFunc) ((void)(ptr), (void)(freeFunc))
+#endif /* DATASTRUCT_ENABLE_EBR */
+
+/* Chaining helpers shared with cht.c */
+HTNode * ht_chain_find(HTNode * head, uint32_t hash, void * key,
+		       size_t keySize, HTNode ** prevNode);
+
+HTNode * ht_node_alloc(void * key, size_t keySize, uint32_t hash,
+		       DSValue * value);
+
+#endif /* HT_INTERNAL__H__ */
@@ -0,0 +1,74 @@
+/**
+ * Integer Keyed HashMap
+ * (C) 2013 Christian Gunderman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#ifndef IMAP__H__
+#define IMAP__H__
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "build_config.h"
+
+/* Key and value pair, stored inline in the slot array */
+typedef struct IMapSlot {
+  uint64_t key;
+  DSValue value;
+} IMapSlot;
+
+/* Integer Keyed HashMap structure definition */
+typedef struct IMap {
+  IMapSlot * slots;
+  unsigned char * states;  /* IMAP_EMPTY, IMAP_FULL or IMAP_DELETED */
+  int tableSize;           /* always a power of two */
+  int shift;               /* 64 - log2(tableSize) */
+  float loadFactor;
+  int numItems;
+  int numDeleted;
+} IMap;
+
+/* IMap Iterator structure definition */
+typedef struct IMapIter {
+  IMap * instance;
+  int index;
+} IMapIter;
+
+IMap * imap_new(int tableSize, float loadFactor);
+
+bool imap_put(IMap * m, uint64_t key, DSValue * newValue,
+	      DSValue * oldValue, bool * prevValue);
+
+bool imap_get(IMap * m, uint64_t key, DSValue * value);
+
+DSValue * imap_get_or_insert(IMap * m, uint64_t key, bool * inserted);
+
+bool imap_reserve(IMap * m, int numItems);
+
+void imap_iter_get(IMap * m, IMapIter * i);
+
+bool imap_iter_has_next(IMapIter * i);
+
+bool imap_iter_next(IMapIter * i, uint64_t * key, DSValue * value,
+		    bool remove);
+
+int imap_size(IMap * m);
+
+void imap_free(IMap * m);
+
+#endif /* IMAP__H__ */
@@ -0,0 +1,52 @@
+/**
+ * String Interning Table
+ * (C) 2013 Christian Gunderman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#ifndef INTERN__H__
+#define INTERN__H__
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "build_config.h"
+#include "ht.h"
+
+/* String Interning Table structure definition */
+typedef struct Intern {
+  HT * ht;             /* string -> ID, and the one copy of each string */
+  HTNode ** nodes;     /* ID -> the node holding the string */
+  int numStrings;
+  int capacity;
+} Intern;
+
+#ifdef DATASTRUCT_ENABLE_INT
+Intern * intern_new(int tableSize);
+
+bool intern_add(Intern * in, void * str, size_t len, uint32_t * id);
+
+bool intern_find(Intern * in, void * str, size_t len, uint32_t * id);
+
+void * intern_get(Intern * in, uint32_t id, size_t * len);
+
+int intern_size(Intern * in);
+
+void intern_free(Intern * in);
+#endif /* DATASTRUCT_ENABLE_INT */
+
+#endif /* INTERN__H__ */
@@ -0,0 +1,57 @@
+/**
+ * Integer HashSet
+ * (C) 2013 Christian Gunderman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#ifndef ISET__H__
+#define ISET__H__
+
+#include <stdlib.h>
+#include <string.h>
+#include "build_config.h"
+#include "imap.h"
+
+/* Preprocessor Definitions */
+#define ISetIter IMapIter
+
+/* Integer HashSet Struct */
+typedef struct ISet {
+  IMap * map;
+}ISet;
+
+ISet * iset_new();
+
+bool iset_add(ISet * s, uint64_t value, bool * prevValue);
+
+bool iset_remove(ISet * s, uint64_t value);
+
+bool iset_contains(ISet * s, uint64_t value);
+
+int iset_size(ISet * s);
+
+bool iset_reserve(ISet * s, int numItems);
+
+void iset_iter_get(ISet * s, ISetIter * i);
+
+bool iset_iter_has_next(ISetIter * i);
+
+bool iset_iter_next(ISetIter * i, uint64_t * value, bool remove);
+
+void iset_free(ISet * s);
+
+#endif /* ISET__H__ */
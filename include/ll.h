@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "build_config.h"
+#include "pool.h"
 
 #define LL_TAIL -1
 
@@ -36,6 +37,7 @@ typedef struct LL {
   LLNode * head;
   LLNode * tail;
   int size;
+  Pool * pool;   /* node pool, or NULL if nodes are malloc'd */
 }LL;
 
 typedef struct LLIter {
@@ -46,6 +48,8 @@ typedef struct LLIter {
 
 LL * ll_new();
 
+LL * ll_new_pooled(int nodesPerSlab);
+
 void ll_free(LL * list);
 
 bool ll_append(LL * list, DSValue item);
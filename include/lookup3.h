@@ -26,5 +26,6 @@
 
 #include <stdint.h>
 uint32_t hashlittle( const void *key, size_t length, uint32_t initval);
+void hashlittle2(const void *key, size_t length, uint32_t *pc, uint32_t *pb);
 
 #endif /* LOOKUP3__H__*/
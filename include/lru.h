@@ -0,0 +1,87 @@
+/**
+ * LRU Cache
+ * (C) 2013 Christian Gunderman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#ifndef LRU__H__
+#define LRU__H__
+
+#include <stdlib.h>
+#include <string.h>
+#include "build_config.h"
+#include "hash.h"
+
+/* Cache entry. Chained in its bucket like an HTNode, and linked into the
+ * recency list. The key is stored after the struct.
+ */
+typedef struct LRUNode {
+  struct LRUNode * next;    /* next node in the bucket */
+  struct LRUNode * newer;   /* recency list neighbours */
+  struct LRUNode * older;
+  uint32_t hash;
+  size_t keySize;
+  size_t size;              /* bytes charged against maxBytes */
+  DSValue value;
+}LRUNode;
+
+/* Called with each entry the cache evicts, and each entry still cached by
+ * lru_free(), so that the value can be released. Not called for entries
+ * replaced by lru_put() or removed by lru_remove(), whose old values are
+ * handed back to the caller.
+ */
+typedef void (*LRUEvictFunc)(void * key, size_t keySize, DSValue * value,
+			     void * context);
+
+/* LRU Cache structure definition */
+typedef struct LRU {
+  LRUNode ** table;
+  int tableSize;            /* always a power of two */
+  int numItems;
+  int maxItems;             /* 0 for no limit */
+  size_t numBytes;
+  size_t maxBytes;          /* 0 for no limit */
+  LRUNode * newest;
+  LRUNode * oldest;
+  uint32_t hashSeed;
+  LRUEvictFunc evictFunc;
+  void * evictContext;
+  unsigned long hits;       /* lru_get() calls that found their key */
+  unsigned long misses;
+  unsigned long evictions;
+}LRU;
+
+LRU * lru_new(int maxItems, size_t maxBytes);
+
+void lru_set_evict_func(LRU * lru, LRUEvictFunc evictFunc, void * context);
+
+bool lru_put(LRU * lru, void * key, size_t keySize, DSValue * newValue,
+	     size_t valueSize, DSValue * oldValue, bool * prevValue);
+
+bool lru_get(LRU * lru, void * key, size_t keySize, DSValue * value);
+
+bool lru_peek(LRU * lru, void * key, size_t keySize, DSValue * value);
+
+bool lru_remove(LRU * lru, void * key, size_t keySize, DSValue * oldValue);
+
+int lru_size(LRU * lru);
+
+size_t lru_bytes(LRU * lru);
+
+void lru_free(LRU * lru);
+
+#endif /* LRU__H__ */
@@ -0,0 +1,56 @@
+/**
+ * Fixed Size Node Pool
+ * (C) 2013 Christian Gunderman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#ifndef POOL__H__
+#define POOL__H__
+
+#include <stdlib.h>
+#include "build_config.h"
+
+/* Slab header, the slab's items follow it */
+typedef struct PoolSlab {
+  struct PoolSlab * next;
+}PoolSlab;
+
+/* Pool of equally sized items carved out of large slabs */
+typedef struct Pool {
+  size_t itemSize;
+  int itemsPerSlab;
+  void * freeList;     /* released items, linked through their first word */
+  PoolSlab * slabs;
+  char * unused;       /* next never-used item in the newest slab */
+  char * unusedEnd;
+  int numSlabs;
+  size_t numBytes;     /* slab memory, headers included */
+}Pool;
+
+Pool * pool_new(size_t itemSize, int itemsPerSlab);
+
+void * pool_alloc(Pool * pool);
+
+void * pool_alloc_block(Pool * pool, int count);
+
+void pool_release(Pool * pool, void * item);
+
+size_t pool_item_size(Pool * pool);
+
+void pool_free(Pool * pool);
+
+#endif /* POOL__H__ */
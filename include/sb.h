@@ -36,10 +36,13 @@ typedef struct tagSB {
   int blockIndex;
   int size;
   LL * list;
+  Pool * blockPool;   /* text block pool, or NULL if blocks are malloc'd */
 }SB;
 
 SB * sb_new(int blockSize);
 
+SB * sb_new_pooled(int blockSize, int blocksPerSlab);
+
 void sb_free(SB * sb);
 
 void sb_append_char(SB * sb, char c);
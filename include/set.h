@@ -40,14 +40,32 @@ typedef struct Set {
 
 Set * set_new();
 
+Set * set_from_array(void ** values, size_t * valueLens, int count,
+		     int numThreads);
+
 bool set_add(Set * s, void * value, size_t valueLen, bool * prevVisited);
 
 bool set_remove(Set * s, void * value, size_t valueLen);
 
 bool set_contains(Set * s, void * value, size_t valueLen);
 
+uint32_t set_hash(Set * s, void * value, size_t valueLen);
+
+bool set_contains_hashed(Set * s, uint32_t hash, void * value,
+			 size_t valueLen);
+
 int set_size(Set * s);
 
+bool set_reserve(Set * s, int numItems);
+
+bool set_compact(Set * s);
+
+bool set_freeze(Set * s);
+
+bool set_stats(Set * s, HTStats * stats);
+
+bool set_stats_dump(Set * s, FILE * file);
+
 void set_iter_get(Set * s, SetIter * i);
 
 bool set_iter_has_next(SetIter * i);
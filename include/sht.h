@@ -0,0 +1,75 @@
+/**
+ * Sharded HashTable
+ * (C) 2013 Christian Gunderman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#ifndef SHT__H__
+#define SHT__H__
+
+#include <stdlib.h>
+#include <string.h>
+#include "build_config.h"
+#include "ht.h"
+
+/* Per-shard callback for sht_for_each_shard(). Runs with the shard's lock
+ * held, and may do anything to the shard except free it. Return false to
+ * report a failure.
+ */
+typedef bool (*SHTShardFunc)(HT * shard, int shardIndex, void * context);
+
+/* Sharded HashTable structure definition */
+typedef struct SHT {
+  int numShards;       /* always a power of two */
+  int shardShift;      /* hash >> shardShift is a key's shard */
+  HashFunc hashFunc;
+  uint32_t hashSeed;
+  void * shards;       /* SHTShard array, see sht.c */
+} SHT;
+
+/* SHT Iterator structure definition */
+typedef struct SHTIter {
+  SHT * instance;
+  int shard;
+  HTIter iter;
+} SHTIter;
+
+SHT * sht_new(int numShards, int tableSize, int blockSize, float loadFactor,
+	      HTOptions * options);
+
+bool sht_put(SHT * sht, void * key, size_t keySize,
+	     DSValue * newValue, DSValue * oldValue, bool * prevValue);
+
+bool sht_get(SHT * sht, void * key, size_t keySize, DSValue * value);
+
+bool sht_remove(SHT * sht, void * key, size_t keySize, DSValue * oldValue);
+
+int sht_size(SHT * sht);
+
+bool sht_for_each_shard(SHT * sht, SHTShardFunc func, void * context,
+			int numThreads);
+
+void sht_iter_get(SHT * sht, SHTIter * i);
+
+bool sht_iter_has_next(SHTIter * i);
+
+bool sht_iter_next(SHTIter * i, void * keyBuffer, size_t keyBufferLen,
+		   DSValue * value, size_t * keyLen, bool remove);
+
+void sht_free(SHT * sht);
+
+#endif /* SHT__H__ */
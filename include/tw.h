@@ -0,0 +1,80 @@
+/**
+ * Hierarchical Timer Wheel
+ * (C) 2013 Christian Gunderman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#ifndef TW__H__
+#define TW__H__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "build_config.h"
+#include "pool.h"
+#include "ll.h"
+
+/* Wheel geometry: TW_LEVELS wheels of 2^TW_SLOT_BITS slots each. Together
+ * they span 2^32 ticks; timers further out than that wait at the top level
+ * for another turn.
+ */
+#define TW_LEVELS 4
+#define TW_SLOT_BITS 8
+#define TW_SLOTS (1 << TW_SLOT_BITS)
+
+struct TW;
+
+/* Called when a timer fires. May schedule and cancel other timers. */
+typedef void (*TWTimerFunc)(struct TW * tw, void * context);
+
+/* Scheduled timer, see tw_schedule() */
+typedef struct TWTimer {
+  uint64_t expires;    /* the tick to fire on */
+  TWTimerFunc func;
+  void * context;
+  bool cancelled;      /* dropped when its slot is next processed */
+}TWTimer;
+
+/* Timer Wheel structure definition. Each slot is a list of TWTimer
+ * pointers, and all slots share one node pool.
+ */
+typedef struct TW {
+  LL slots[TW_LEVELS][TW_SLOTS];
+  int levelNodes[TW_LEVELS];  /* list nodes in each level, cancelled
+			       * timers included */
+  uint64_t resolution;   /* time units per tick */
+  uint64_t currentTick;
+  int numTimers;         /* scheduled and not cancelled */
+  Pool * nodePool;
+  Pool * timerPool;
+}TW;
+
+#ifdef DATASTRUCT_ENABLE_POINTER
+TW * tw_new(uint64_t resolution, uint64_t now);
+
+TWTimer * tw_schedule(TW * tw, uint64_t deadline, TWTimerFunc func,
+		      void * context);
+
+void tw_cancel(TW * tw, TWTimer * timer);
+
+int tw_advance(TW * tw, uint64_t now);
+
+int tw_size(TW * tw);
+
+void tw_free(TW * tw);
+#endif /* DATASTRUCT_ENABLE_POINTER */
+
+#endif /* TW__H__ */
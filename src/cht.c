@@ -0,0 +1,361 @@
+/**
+ * Lock Striped Concurrent HashTable
+ * (C) 2013 Christian Gunderman
+ *
+ * A thread safe hashtable built on the HT chaining code. There is one
+ * bucket array, and bucket i is guarded by reader/writer lock
+ * i % numStripes. Gets on different stripes never contend and gets on the
+ * same stripe share a read lock. Because the table and the stripe count
+ * are both powers of two, a key's stripe is fixed by the low bits of its
+ * hash and does not change when the table doubles. A resize takes every
+ * stripe's write lock, in order, and moves nodes without rehashing them.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+/* pthread_rwlock_t is not visible in strict C89 mode without this */
+#define _XOPEN_SOURCE 600
+
+#include <pthread.h>
+#include "cht.h"
+#include "ht_internal.h"
+#include "lookup3.h"
+
+/* stripes are padded to this many bytes so they don't share cache lines */
+#define CHT_CACHE_LINE 64
+
+/* per-stripe state */
+typedef struct CHTStripe {
+  pthread_rwlock_t lock;
+  long numItems;
+} CHTStripe;
+
+/* Relaxed atomic access to the stripe counters, which cht_size() reads
+ * without taking the stripe locks.
+ */
+#ifdef __GNUC__
+#define COUNT_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define COUNT_ADD(p, n) __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+#else
+#define COUNT_LOAD(p) (*(volatile long *)(p))
+#define COUNT_ADD(p, n) (*(p) += (n))
+#endif /* __GNUC__ */
+
+/**
+ * Gets the size of a padded stripe.
+ */
+static size_t stripe_stride() {
+  return (sizeof(CHTStripe) + CHT_CACHE_LINE - 1)
+    / CHT_CACHE_LINE * CHT_CACHE_LINE;
+}
+
+/**
+ * Gets stripe n.
+ */
+static CHTStripe * get_stripe(CHT * cht, int n) {
+  return (CHTStripe*)((char*)cht->stripes + stripe_stride() * n);
+}
+
+/**
+ * Hashes a key.
+ */
+static uint32_t cht_hash(void * key, size_t keySize) {
+  return hashlittle(key, keySize, 0);
+}
+
+/**
+ * Gets the stripe guarding a hash's bucket. Equal to the bucket index
+ * modulo numStripes for every table size, so no lock is needed to find it.
+ */
+static CHTStripe * stripe_for_hash(CHT * cht, uint32_t hash) {
+  return get_stripe(cht, hash & (cht->numStripes - 1));
+}
+
+/**
+ * Rounds n up to a power of two.
+ */
+static int round_pow2(int n) {
+  int pow2 = 1;
+
+  while(pow2 < n) {
+    pow2 <<= 1;
+  }
+  return pow2;
+}
+
+/**
+ * Creates a new concurrent hashtable.
+ * tableSize: initial number of buckets, rounded up to a power of two.
+ * numStripes: number of locks, rounded up to a power of two. More stripes
+ * mean less contention between writers. Somewhere between 4x and 16x
+ * the number of threads is typical.
+ * loadFactor: load upon which the table is doubled.
+ * returns: a new CHT, or NULL on memory allocation error.
+ */
+CHT * cht_new(int tableSize, int numStripes, float loadFactor) {
+  CHT * cht = (CHT*)calloc(1, sizeof(CHT));
+  int n;
+
+  if(cht == NULL) {
+    return NULL;
+  }
+
+  cht->numStripes = round_pow2(numStripes);
+  cht->tableSize = round_pow2(tableSize);
+  cht->loadFactor = loadFactor;
+
+  /* every stripe must own at least one bucket */
+  if(cht->tableSize < cht->numStripes) {
+    cht->tableSize = cht->numStripes;
+  }
+
+  cht->table = (HTNode**)calloc(cht->tableSize, sizeof(HTNode*));
+  cht->stripes = calloc(cht->numStripes, stripe_stride());
+  if(cht->table == NULL || cht->stripes == NULL) {
+    free(cht->table);
+    free(cht->stripes);
+    free(cht);
+    return NULL;
+  }
+
+  for(n = 0; n < cht->numStripes; n++) {
+    pthread_rwlock_init(&get_stripe(cht, n)->lock, NULL);
+  }
+
+  return cht;
+}
+
+/**
+ * Gets the head pointer of a hash's bucket. The caller must hold the
+ * bucket's stripe lock.
+ */
+static HTNode ** bucket_for_hash(CHT * cht, uint32_t hash) {
+  return &cht->table[hash & (cht->tableSize - 1)];
+}
+
+/**
+ * Doubles the table if it is still above its load factor. Takes every
+ * stripe's write lock, so all other operations wait for it.
+ * expectedSize: the table size seen by the caller. If another thread has
+ * already resized, nothing is done.
+ */
+static void cht_grow(CHT * cht, int expectedSize) {
+  HTNode ** newTable;
+  int newSize;
+  int n;
+
+  /* lock ordering: always stripe 0 up, so resizers can't deadlock */
+  for(n = 0; n < cht->numStripes; n++) {
+    pthread_rwlock_wrlock(&get_stripe(cht, n)->lock);
+  }
+
+  newSize = cht->tableSize * 2;
+  if(cht->tableSize == expectedSize
+     && cht_size(cht) >= cht->tableSize * cht->loadFactor
+     && (newTable = (HTNode**)calloc(newSize, sizeof(HTNode*))) != NULL) {
+
+    /* relink every node using its stored hash */
+    for(n = 0; n < cht->tableSize; n++) {
+      HTNode * node = cht->table[n];
+
+      while(node != NULL) {
+	HTNode * next = node->next;
+	HTNode ** bucket = &newTable[node->hash & (newSize - 1)];
+
+	node->next = *bucket;
+	*bucket = node;
+	node = next;
+      }
+    }
+
+    free(cht->table);
+    cht->table = newTable;
+    cht->tableSize = newSize;
+  }
+
+  for(n = cht->numStripes - 1; n >= 0; n--) {
+    pthread_rwlock_unlock(&get_stripe(cht, n)->lock);
+  }
+}
+
+/**
+ * Stores a value. Safe to call from any thread. Same contract as
+ * ht_put_raw_key().
+ * cht: the concurrent hashtable instance.
+ * key: the key which the value will be hashed to.
+ * keySize: The number of bytes from key that will be used for the key.
+ * newValue: A pointer to a new value to store. If this value is NULL, the
+ * item at the specified key is removed.
+ * oldValue: A buffer that will recv. the old value, or NULL.
+ * prevValue: recv. whether or not the key previously had a value, or NULL.
+ * return: true on success, or false on memory allocation error.
+ */
+bool cht_put(CHT * cht, void * key, size_t keySize,
+	     DSValue * newValue, DSValue * oldValue, bool * prevValue) {
+  uint32_t hash = cht_hash(key, keySize);
+  CHTStripe * stripe = stripe_for_hash(cht, hash);
+  HTNode * newNode = NULL;
+  HTNode ** bucket;
+  HTNode * prevNode;
+  HTNode * node;
+  bool grow = false;
+  int tableSize;
+
+  /* allocate outside of the lock, it is thrown away if the key exists */
+  if(newValue != NULL) {
+    newNode = ht_node_alloc(key, keySize, hash, newValue);
+    if(newNode == NULL) {
+      return false;
+    }
+  }
+
+  pthread_rwlock_wrlock(&stripe->lock);
+
+  bucket = bucket_for_hash(cht, hash);
+  node = ht_chain_find(*bucket, hash, key, keySize, &prevNode);
+
+  if(prevValue != NULL) {
+    *prevValue = (node != NULL);
+  }
+
+  if(node != NULL) {
+    if(oldValue != NULL) {
+      memcpy(oldValue, &node->value, sizeof(DSValue));
+    }
+
+    if(newValue != NULL) {
+      memcpy(&node->value, newValue, sizeof(DSValue));
+    } else {
+
+      /* unlink and free it below, outside of the lock */
+      if(prevNode != NULL) {
+	prevNode->next = node->next;
+      } else {
+	*bucket = node->next;
+      }
+      COUNT_ADD(&stripe->numItems, -1);
+      newNode = node;
+    }
+  } else if(newNode != NULL) {
+    newNode->next = *bucket;
+    *bucket = newNode;
+    newNode = NULL;
+
+    /* this stripe's share of the table is over the load factor */
+    COUNT_ADD(&stripe->numItems, 1);
+    grow = stripe->numItems * cht->numStripes
+      >= cht->tableSize * cht->loadFactor;
+  }
+
+  tableSize = cht->tableSize;
+  pthread_rwlock_unlock(&stripe->lock);
+
+  /* either an unused new node or a removed one */
+  free(newNode);
+
+  if(grow) {
+    cht_grow(cht, tableSize);
+  }
+
+  return true;
+}
+
+/**
+ * Gets a value. Safe to call from any thread. Same contract as
+ * ht_get_raw_key().
+ * cht: the concurrent hashtable instance.
+ * key: the key at which the value will be looked up.
+ * keySize: the number of bytes from key to be used as the key.
+ * value: recv. the stored value if it exists, or NULL.
+ * returns: true if the specified value exists and false if it does not.
+ */
+bool cht_get(CHT * cht, void * key, size_t keySize, DSValue * value) {
+  uint32_t hash = cht_hash(key, keySize);
+  CHTStripe * stripe = stripe_for_hash(cht, hash);
+  HTNode * prevNode;
+  HTNode * node;
+
+  pthread_rwlock_rdlock(&stripe->lock);
+
+  node = ht_chain_find(*bucket_for_hash(cht, hash), hash, key, keySize,
+		       &prevNode);
+  if(node != NULL && value != NULL) {
+    memcpy(value, &node->value, sizeof(DSValue));
+  }
+
+  pthread_rwlock_unlock(&stripe->lock);
+
+  return node != NULL;
+}
+
+/**
+ * Removes a value. Safe to call from any thread.
+ * cht: the concurrent hashtable instance.
+ * key: the key to remove.
+ * keySize: the number of bytes from key to be used as the key.
+ * oldValue: recv. the removed value, or NULL.
+ * returns: true if the key existed.
+ */
+bool cht_remove(CHT * cht, void * key, size_t keySize, DSValue * oldValue) {
+  bool prevValue = false;
+
+  cht_put(cht, key, keySize, NULL, oldValue, &prevValue);
+  return prevValue;
+}
+
+/**
+ * Gets the number of items in the table. Takes no locks; while other
+ * threads are writing the result is a recent, not an exact, count.
+ * cht: the concurrent hashtable instance.
+ * returns: the number of items.
+ */
+int cht_size(CHT * cht) {
+  long numItems = 0;
+  int n;
+
+  for(n = 0; n < cht->numStripes; n++) {
+    numItems += COUNT_LOAD(&get_stripe(cht, n)->numItems);
+  }
+  return (int)numItems;
+}
+
+/**
+ * Frees the table and all of its nodes. No other thread may be using it.
+ * Pointers stored as values are not freed.
+ * cht: the concurrent hashtable instance.
+ */
+void cht_free(CHT * cht) {
+  int n;
+
+  for(n = 0; n < cht->tableSize; n++) {
+    HTNode * node = cht->table[n];
+
+    while(node != NULL) {
+      HTNode * next = node->next;
+
+      free(node);
+      node = next;
+    }
+  }
+
+  for(n = 0; n < cht->numStripes; n++) {
+    pthread_rwlock_destroy(&get_stripe(cht, n)->lock);
+  }
+
+  free(cht->stripes);
+  free(cht->table);
+  free(cht);
+}
@@ -0,0 +1,277 @@
+/**
+ * Epoch Based Reclamation
+ * (C) 2013 Christian Gunderman
+ *
+ * Lets readers walk a shared structure without locks while a writer
+ * unlinks and frees parts of it. Readers bracket each access with
+ * ebr_enter() and ebr_exit(). A writer that unlinks memory hands it to
+ * ebr_retire() instead of freeing it. The memory is freed two epoch
+ * advances later, when every reader that could have seen it has left.
+ *
+ * The global epoch can only advance when every reader inside a read
+ * section has seen the current epoch, so a reader that never leaves its
+ * section holds up all reclamation. Keep sections short.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+/* pthread and sched_yield are not visible in strict C89 mode without this */
+#define _XOPEN_SOURCE 600
+
+#include "ebr.h"
+
+#ifdef DATASTRUCT_ENABLE_EBR
+
+#include <pthread.h>
+#include <sched.h>
+
+/* number of retires between automatic collection attempts */
+#define EBR_COLLECT_INTERVAL 64
+
+/**
+ * Gets the domain's mutex, which guards the thread list and limbo lists.
+ */
+static pthread_mutex_t * ebr_lock(EBR * ebr) {
+  return (pthread_mutex_t*)ebr->lock;
+}
+
+/**
+ * Creates a new reclamation domain.
+ * returns: a new EBR, or NULL on memory allocation error.
+ */
+EBR * ebr_new() {
+  EBR * ebr = (EBR*)calloc(1, sizeof(EBR));
+
+  if(ebr == NULL) {
+    return NULL;
+  }
+
+  ebr->lock = malloc(sizeof(pthread_mutex_t));
+  if(ebr->lock == NULL) {
+    free(ebr);
+    return NULL;
+  }
+  pthread_mutex_init(ebr_lock(ebr), NULL);
+
+  return ebr;
+}
+
+/**
+ * Registers the calling thread as a reader. Each reading thread needs its
+ * own record, and must not share it with other threads.
+ * ebr: the reclamation domain.
+ * returns: the thread's record, or NULL on memory allocation error.
+ */
+EBRThread * ebr_register(EBR * ebr) {
+  EBRThread * thread;
+
+  pthread_mutex_lock(ebr_lock(ebr));
+
+  /* reuse the record of a thread that has unregistered */
+  for(thread = ebr->threads; thread != NULL; thread = thread->next) {
+    if(!thread->inUse) {
+      break;
+    }
+  }
+
+  if(thread == NULL) {
+    thread = (EBRThread*)calloc(1, sizeof(EBRThread));
+    if(thread != NULL) {
+      thread->owner = ebr;
+      thread->next = ebr->threads;
+      ebr->threads = thread;
+    }
+  }
+
+  if(thread != NULL) {
+    thread->inUse = true;
+  }
+
+  pthread_mutex_unlock(ebr_lock(ebr));
+
+  return thread;
+}
+
+/**
+ * Releases a reader record. The thread must be outside of a read section.
+ * thread: the record returned by ebr_register().
+ */
+void ebr_unregister(EBRThread * thread) {
+  EBR * ebr = thread->owner;
+
+  pthread_mutex_lock(ebr_lock(ebr));
+  __atomic_store_n(&thread->state, 0, __ATOMIC_RELEASE);
+  thread->inUse = false;
+  pthread_mutex_unlock(ebr_lock(ebr));
+}
+
+/**
+ * Starts a read section. Pointers loaded from the shared structure stay
+ * valid until ebr_exit(). Sections do not nest.
+ * thread: the calling thread's record.
+ */
+void ebr_enter(EBRThread * thread) {
+  unsigned long epoch = __atomic_load_n(&thread->owner->epoch,
+					__ATOMIC_ACQUIRE);
+
+  /* the full barrier orders this announcement before every load the
+   * section makes, so a writer that sees us inactive knows we haven't
+   * loaded anything yet
+   */
+  __atomic_store_n(&thread->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/**
+ * Ends a read section. Pointers loaded in the section must not be used
+ * afterwards.
+ * thread: the calling thread's record.
+ */
+void ebr_exit(EBRThread * thread) {
+  __atomic_store_n(&thread->state, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Frees a list of retired pointers.
+ */
+static void free_retired(EBRRetired * retired) {
+  while(retired != NULL) {
+    EBRRetired * next = retired->next;
+
+    retired->freeFunc(retired->ptr);
+    free(retired);
+    retired = next;
+  }
+}
+
+/**
+ * Schedules memory that has been unlinked from a shared structure to be
+ * freed once no reader can still reach it. Every few calls also tries to
+ * advance the epoch and free what has become safe.
+ * ebr: the reclamation domain.
+ * ptr: the unlinked memory.
+ * freeFunc: called with ptr to free it, for instance free().
+ */
+void ebr_retire(EBR * ebr, void * ptr, EBRFreeFunc freeFunc) {
+  EBRRetired * retired = (EBRRetired*)malloc(sizeof(EBRRetired));
+  bool collect;
+
+  /* no memory to defer it, so wait out the readers and free it now */
+  if(retired == NULL) {
+    ebr_synchronize(ebr);
+    freeFunc(ptr);
+    return;
+  }
+
+  retired->ptr = ptr;
+  retired->freeFunc = freeFunc;
+
+  pthread_mutex_lock(ebr_lock(ebr));
+  retired->next = ebr->limbo[ebr->epoch % 3];
+  ebr->limbo[ebr->epoch % 3] = retired;
+  collect = ++ebr->numRetired >= EBR_COLLECT_INTERVAL;
+  pthread_mutex_unlock(ebr_lock(ebr));
+
+  if(collect) {
+    ebr_collect(ebr);
+  }
+}
+
+/**
+ * Tries to advance the epoch. It can only move forward once every reader
+ * inside a read section has entered during the current epoch. Pointers
+ * retired two epochs ago are freed on success.
+ * ebr: the reclamation domain.
+ * returns: true if the epoch advanced.
+ */
+bool ebr_collect(EBR * ebr) {
+  EBRRetired * reclaim;
+  EBRThread * thread;
+  unsigned long epoch;
+
+  pthread_mutex_lock(ebr_lock(ebr));
+
+  ebr->numRetired = 0;
+  epoch = ebr->epoch;
+
+  for(thread = ebr->threads; thread != NULL; thread = thread->next) {
+    unsigned long state = __atomic_load_n(&thread->state, __ATOMIC_SEQ_CST);
+
+    if((state & 1) && (state >> 1) != epoch) {
+      pthread_mutex_unlock(ebr_lock(ebr));
+      return false;
+    }
+  }
+
+  /* everything retired in epoch - 1 is now unreachable, and it shares a
+   * limbo list with epoch + 2
+   */
+  epoch++;
+  __atomic_store_n(&ebr->epoch, epoch, __ATOMIC_RELEASE);
+  reclaim = ebr->limbo[(epoch + 1) % 3];
+  ebr->limbo[(epoch + 1) % 3] = NULL;
+
+  pthread_mutex_unlock(ebr_lock(ebr));
+
+  /* run the free functions outside of the lock in case they retire more */
+  free_retired(reclaim);
+
+  return true;
+}
+
+/**
+ * Waits until everything retired so far has been freed. Must not be called
+ * from inside a read section, or it waits forever.
+ * ebr: the reclamation domain.
+ */
+void ebr_synchronize(EBR * ebr) {
+  int advances = 0;
+
+  while(advances < 2) {
+    if(ebr_collect(ebr)) {
+      advances++;
+    } else {
+      sched_yield();
+    }
+  }
+}
+
+/**
+ * Frees the domain, every reader record, and everything still retired. No
+ * thread may be using it.
+ * ebr: the reclamation domain.
+ */
+void ebr_free(EBR * ebr) {
+  EBRThread * thread = ebr->threads;
+  int i;
+
+  for(i = 0; i < 3; i++) {
+    free_retired(ebr->limbo[i]);
+  }
+
+  while(thread != NULL) {
+    EBRThread * next = thread->next;
+
+    free(thread);
+    thread = next;
+  }
+
+  pthread_mutex_destroy(ebr_lock(ebr));
+  free(ebr->lock);
+  free(ebr);
+}
+
+#endif /* DATASTRUCT_ENABLE_EBR */
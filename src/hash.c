@@ -0,0 +1,297 @@
+/**
+ * Hash Functions
+ * (C) 2013 Christian Gunderman
+ *
+ * Hash functions that a table can select with HTOptions.hashFunc:
+ *
+ * hash_lookup3: Bob Jenkins' lookup3. The default, and the only hash
+ * tables used before hash functions were selectable.
+ * hash_wy: a wyhash style multiply-mix hash that reads 16 bytes per step.
+ * On 64-bit CPUs it is about twice as fast as lookup3 for keys of 32 bytes
+ * and up.
+ * hash_crc32c: CRC32C, using the SSE4.2 crc32 instruction when the CPU has
+ * it, and a table otherwise. Fastest for short keys on such CPUs. CRC is
+ * linear, so which keys collide doesn't depend on the seed; don't use it
+ * for keys an attacker chooses.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "hash.h"
+#include "lookup3.h"
+
+/* builds a 64-bit constant from two halves, C89 has no 64-bit literals */
+#define U64(hi, lo) (((uint64_t)(hi) << 32) | (uint64_t)(lo))
+
+/* the SSE4.2 crc32 instruction can be used, subject to a runtime check */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HASH_CRC32C_SSE42
+#endif
+
+/**
+ * lookup3 with the seed as its initval.
+ */
+uint32_t hash_lookup3(const void * key, size_t keySize, uint32_t seed) {
+  return hashlittle(key, keySize, seed);
+}
+
+/**
+ * Reads 8 bytes, in native byte order, from a possibly unaligned address.
+ */
+static uint64_t read64(const unsigned char * p) {
+  uint64_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/**
+ * Reads 4 bytes, in native byte order, from a possibly unaligned address.
+ */
+static uint64_t read32(const unsigned char * p) {
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+/**
+ * Multiplies a and b to 128 bits, leaving the low half in a and the high
+ * half in b.
+ */
+static void mum(uint64_t * a, uint64_t * b) {
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t)*a * *b;
+
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32;
+  uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+
+  c += lo < t;
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif /* __SIZEOF_INT128__ */
+}
+
+/**
+ * Multiplies and folds the two halves of the product together.
+ */
+static uint64_t mix(uint64_t a, uint64_t b) {
+  mum(&a, &b);
+  return a ^ b;
+}
+
+/**
+ * wyhash style hash, folded to 32 bits.
+ */
+uint32_t hash_wy(const void * key, size_t keySize, uint32_t seed) {
+  const uint64_t s0 = U64(0xa0761d64, 0x78bd642f);
+  const uint64_t s1 = U64(0xe7037ed1, 0xa0b428db);
+  const unsigned char * p = (const unsigned char*)key;
+  uint64_t state = mix((uint64_t)seed ^ s0, s1);
+  uint64_t a;
+  uint64_t b;
+  uint64_t h;
+
+  if(keySize <= 16) {
+    if(keySize >= 4) {
+
+      /* two overlapping reads from each end cover 4 to 16 bytes */
+      size_t shift = (keySize >> 3) << 2;
+
+      a = (read32(p) << 32) | read32(p + shift);
+      b = (read32(p + keySize - 4) << 32) | read32(p + keySize - 4 - shift);
+    } else if(keySize > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[keySize >> 1] << 8)
+	| p[keySize - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = keySize;
+
+    while(i > 16) {
+      state = mix(read64(p) ^ s1, read64(p + 8) ^ state);
+      p += 16;
+      i -= 16;
+    }
+
+    /* the last 16 bytes, overlapping the final step if needed */
+    a = read64(p + i - 16);
+    b = read64(p + i - 8);
+  }
+
+  a ^= s1;
+  b ^= state;
+  mum(&a, &b);
+  h = mix(a ^ s0 ^ keySize, b ^ s1);
+
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+/* CRC32C (Castagnoli, reflected polynomial 0x82F63B78) byte table */
+static const uint32_t crc32cTable[256] = {
+  0x00000000u, 0xf26b8303u, 0xe13b70f7u, 0x1350f3f4u,
+  0xc79a971fu, 0x35f1141cu, 0x26a1e7e8u, 0xd4ca64ebu,
+  0x8ad958cfu, 0x78b2dbccu, 0x6be22838u, 0x9989ab3bu,
+  0x4d43cfd0u, 0xbf284cd3u, 0xac78bf27u, 0x5e133c24u,
+  0x105ec76fu, 0xe235446cu, 0xf165b798u, 0x030e349bu,
+  0xd7c45070u, 0x25afd373u, 0x36ff2087u, 0xc494a384u,
+  0x9a879fa0u, 0x68ec1ca3u, 0x7bbcef57u, 0x89d76c54u,
+  0x5d1d08bfu, 0xaf768bbcu, 0xbc267848u, 0x4e4dfb4bu,
+  0x20bd8edeu, 0xd2d60dddu, 0xc186fe29u, 0x33ed7d2au,
+  0xe72719c1u, 0x154c9ac2u, 0x061c6936u, 0xf477ea35u,
+  0xaa64d611u, 0x580f5512u, 0x4b5fa6e6u, 0xb93425e5u,
+  0x6dfe410eu, 0x9f95c20du, 0x8cc531f9u, 0x7eaeb2fau,
+  0x30e349b1u, 0xc288cab2u, 0xd1d83946u, 0x23b3ba45u,
+  0xf779deaeu, 0x05125dadu, 0x1642ae59u, 0xe4292d5au,
+  0xba3a117eu, 0x4851927du, 0x5b016189u, 0xa96ae28au,
+  0x7da08661u, 0x8fcb0562u, 0x9c9bf696u, 0x6ef07595u,
+  0x417b1dbcu, 0xb3109ebfu, 0xa0406d4bu, 0x522bee48u,
+  0x86e18aa3u, 0x748a09a0u, 0x67dafa54u, 0x95b17957u,
+  0xcba24573u, 0x39c9c670u, 0x2a993584u, 0xd8f2b687u,
+  0x0c38d26cu, 0xfe53516fu, 0xed03a29bu, 0x1f682198u,
+  0x5125dad3u, 0xa34e59d0u, 0xb01eaa24u, 0x42752927u,
+  0x96bf4dccu, 0x64d4cecfu, 0x77843d3bu, 0x85efbe38u,
+  0xdbfc821cu, 0x2997011fu, 0x3ac7f2ebu, 0xc8ac71e8u,
+  0x1c661503u, 0xee0d9600u, 0xfd5d65f4u, 0x0f36e6f7u,
+  0x61c69362u, 0x93ad1061u, 0x80fde395u, 0x72966096u,
+  0xa65c047du, 0x5437877eu, 0x4767748au, 0xb50cf789u,
+  0xeb1fcbadu, 0x197448aeu, 0x0a24bb5au, 0xf84f3859u,
+  0x2c855cb2u, 0xdeeedfb1u, 0xcdbe2c45u, 0x3fd5af46u,
+  0x7198540du, 0x83f3d70eu, 0x90a324fau, 0x62c8a7f9u,
+  0xb602c312u, 0x44694011u, 0x5739b3e5u, 0xa55230e6u,
+  0xfb410cc2u, 0x092a8fc1u, 0x1a7a7c35u, 0xe811ff36u,
+  0x3cdb9bddu, 0xceb018deu, 0xdde0eb2au, 0x2f8b6829u,
+  0x82f63b78u, 0x709db87bu, 0x63cd4b8fu, 0x91a6c88cu,
+  0x456cac67u, 0xb7072f64u, 0xa457dc90u, 0x563c5f93u,
+  0x082f63b7u, 0xfa44e0b4u, 0xe9141340u, 0x1b7f9043u,
+  0xcfb5f4a8u, 0x3dde77abu, 0x2e8e845fu, 0xdce5075cu,
+  0x92a8fc17u, 0x60c37f14u, 0x73938ce0u, 0x81f80fe3u,
+  0x55326b08u, 0xa759e80bu, 0xb4091bffu, 0x466298fcu,
+  0x1871a4d8u, 0xea1a27dbu, 0xf94ad42fu, 0x0b21572cu,
+  0xdfeb33c7u, 0x2d80b0c4u, 0x3ed04330u, 0xccbbc033u,
+  0xa24bb5a6u, 0x502036a5u, 0x4370c551u, 0xb11b4652u,
+  0x65d122b9u, 0x97baa1bau, 0x84ea524eu, 0x7681d14du,
+  0x2892ed69u, 0xdaf96e6au, 0xc9a99d9eu, 0x3bc21e9du,
+  0xef087a76u, 0x1d63f975u, 0x0e330a81u, 0xfc588982u,
+  0xb21572c9u, 0x407ef1cau, 0x532e023eu, 0xa145813du,
+  0x758fe5d6u, 0x87e466d5u, 0x94b49521u, 0x66df1622u,
+  0x38cc2a06u, 0xcaa7a905u, 0xd9f75af1u, 0x2b9cd9f2u,
+  0xff56bd19u, 0x0d3d3e1au, 0x1e6dcdeeu, 0xec064eedu,
+  0xc38d26c4u, 0x31e6a5c7u, 0x22b65633u, 0xd0ddd530u,
+  0x0417b1dbu, 0xf67c32d8u, 0xe52cc12cu, 0x1747422fu,
+  0x49547e0bu, 0xbb3ffd08u, 0xa86f0efcu, 0x5a048dffu,
+  0x8ecee914u, 0x7ca56a17u, 0x6ff599e3u, 0x9d9e1ae0u,
+  0xd3d3e1abu, 0x21b862a8u, 0x32e8915cu, 0xc083125fu,
+  0x144976b4u, 0xe622f5b7u, 0xf5720643u, 0x07198540u,
+  0x590ab964u, 0xab613a67u, 0xb831c993u, 0x4a5a4a90u,
+  0x9e902e7bu, 0x6cfbad78u, 0x7fab5e8cu, 0x8dc0dd8fu,
+  0xe330a81au, 0x115b2b19u, 0x020bd8edu, 0xf0605beeu,
+  0x24aa3f05u, 0xd6c1bc06u, 0xc5914ff2u, 0x37faccf1u,
+  0x69e9f0d5u, 0x9b8273d6u, 0x88d28022u, 0x7ab90321u,
+  0xae7367cau, 0x5c18e4c9u, 0x4f48173du, 0xbd23943eu,
+  0xf36e6f75u, 0x0105ec76u, 0x12551f82u, 0xe03e9c81u,
+  0x34f4f86au, 0xc69f7b69u, 0xd5cf889du, 0x27a40b9eu,
+  0x79b737bau, 0x8bdcb4b9u, 0x988c474du, 0x6ae7c44eu,
+  0xbe2da0a5u, 0x4c4623a6u, 0x5f16d052u, 0xad7d5351u
+};
+
+/**
+ * Table driven CRC32C, one byte at a time.
+ */
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char * p,
+			  size_t len) {
+  while(len-- > 0) {
+    crc = crc32cTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#ifdef HASH_CRC32C_SSE42
+/**
+ * CRC32C using the SSE4.2 crc32 instruction. Only call if the CPU
+ * supports it.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char * p,
+			  size_t len) {
+#ifdef __x86_64__
+  for(; len >= 8; p += 8, len -= 8) {
+    crc = (uint32_t)__builtin_ia32_crc32di(crc, read64(p));
+  }
+#endif /* __x86_64__ */
+  for(; len >= 4; p += 4, len -= 4) {
+    crc = __builtin_ia32_crc32si(crc, (uint32_t)read32(p));
+  }
+  for(; len > 0; p++, len--) {
+    crc = __builtin_ia32_crc32qi(crc, *p);
+  }
+  return crc;
+}
+#endif /* HASH_CRC32C_SSE42 */
+
+/**
+ * CRC32C of the key, starting from the inverted seed. Fast, but CRC is
+ * affine in the seed: equal length keys that collide under one seed
+ * collide under every seed. A random seed gives it no resistance to
+ * crafted keys; use hash_wy or hash_lookup3 for untrusted keys.
+ */
+uint32_t hash_crc32c(const void * key, size_t keySize, uint32_t seed) {
+  const unsigned char * p = (const unsigned char*)key;
+
+#ifdef HASH_CRC32C_SSE42
+  if(__builtin_cpu_supports("sse4.2")) {
+    return ~crc32c_hw(~seed, p, keySize);
+  }
+#endif /* HASH_CRC32C_SSE42 */
+
+  return ~crc32c_sw(~seed, p, keySize);
+}
+
+/**
+ * Gets an unpredictable seed for a table, so that keys crafted to collide
+ * under one seed don't collide in every table. That only holds for hashes
+ * that mix the seed in nonlinearly, such as hash_lookup3 and hash_wy, and
+ * not for hash_crc32c. Uses /dev/urandom when it exists, mixed with the
+ * time and the address of a local variable.
+ * returns: a random seed.
+ */
+uint32_t hash_random_seed() {
+  uint64_t entropy = (uint64_t)time(NULL) ^ ((uint64_t)clock() << 32);
+  uint32_t urandom = 0;
+  FILE * fp = fopen("/dev/urandom", "rb");
+
+  if(fp != NULL) {
+    if(fread(&urandom, sizeof(urandom), 1, fp) != 1) {
+      urandom = 0;
+    }
+    fclose(fp);
+  }
+
+  entropy ^= (uint64_t)(size_t)&fp;
+  return hash_wy(&entropy, sizeof(entropy), urandom);
+}
@@ -19,108 +19,353 @@
  */
 
 #include "ht.h"
-#include "lookup3.h"
+#include "ht_internal.h"
 #include <stdio.h>
 
+/* Bucket array as seen by lock-free readers. The array and its size are
+ * published together, so a reader never pairs one with the other's size.
+ */
+typedef struct HTReadView {
+  HTNode ** heads;
+  int size;
+  unsigned int mask;
+} HTReadView;
+
 /**
  * Hashes a key to an integer value
- * If you have a problem with the hash function I use, feel free to change it.
- * ht: the context of the HT
+ * If you have a problem with the hash function I use, pick another one
+ * with HTOptions.hashFunc.
+ * ht: the hashtable instance, which supplies the hash function and seed.
  * key: the key to hash
  * keySize: the length of the key to hash, in bytes.
  */
-static long hash_to_index(HT * ht, void * key, size_t keySize) {
+static uint32_t hash_key(HT * ht, void * key, size_t keySize) {
 
   /*
-   * Hashes index using Bob Jenkins Lookup3.c. Obviously, this is not
+   * Defaults to Bob Jenkins Lookup3.c. Obviously, this is not
    * as complex a hash as Sha256, but Sha and other high end hashes are
    * not neccessary for something as small scale as a hash table.
    * for more info, read Bob Jenkins webpage on hashing algorithms.
    * <http://burtleburtle.net/bob/hash/doobs.html>
    */
-  return hashlittle(key,  keySize, 0) % ht->tableSize;
+  return HT_HASH(ht, key, keySize);
 }
 
 /**
- * Frees a node struct
- * node: the node to free.
+ * Maps a hash to an index in a bucket array.
+ * hash: the key's hash.
+ * tableSize: the number of buckets in the array.
+ * indexMask: tableSize - 1 if tableSize is a power of two, otherwise 0.
  */
-static void node_free(HTNode * node) {
-  free(node->key);
-  free(node);
+static int bucket_index(uint32_t hash, int tableSize, unsigned int indexMask) {
+
+  /* power of two tables can mask instead of dividing */
+  if(indexMask != 0) {
+    return hash & indexMask;
+  }
+  return hash % tableSize;
 }
 
 /**
- * Gets the last node in a linked list of nodes.
- * node: the starting node in the list
- * returns: The the last node in the list
+ * Gets the index mask for a number of buckets: tableSize - 1 if it is a
+ * power of two, otherwise 0.
  */
-static HTNode * node_list_last(HTNode * node) {
-  if(node == NULL) {
-    return NULL;
+static unsigned int index_mask(int tableSize) {
+  return (tableSize > 1 && (tableSize & (tableSize - 1)) == 0)
+    ? (unsigned int)(tableSize - 1) : 0;
+}
+
+/**
+ * Sets tableSize and the matching index mask.
+ * ht: the hashtable instance.
+ * tableSize: the new number of buckets.
+ */
+static void set_table_size(HT * ht, int tableSize) {
+  ht->tableSize = tableSize;
+  ht->indexMask = index_mask(tableSize);
+}
+
+/**
+ * Checks whether a node with a key of keySize bytes comes from the node pool.
+ */
+static bool node_is_pooled(HT * ht, size_t keySize) {
+  return ht->nodePool != NULL && keySize <= HT_POOL_KEY_SIZE;
+}
+
+/**
+ * Frees a node struct and its key.
+ * ht: the hashtable the node belongs to.
+ * node: the node to free.
+ */
+static void node_free(HT * ht, HTNode * node) {
+  if(node_is_pooled(ht, node->keySize)) {
+    pool_release(ht->nodePool, node);
+    return;
   }
 
-  /* iterate to last node */
-  while(node->next != NULL) {
-    node = node->next;
+  if(ht->nodePool != NULL) {
+    ht->heapNodes--;
   }
+  free(node);
+}
 
-  return node;
+/**
+ * Unlinks a node from its chain, frees it and uncounts it. In lock-free
+ * read mode the node is retired instead, since a reader may be on it.
+ * ht: the hashtable the node belongs to.
+ * link: the bucket head or next pointer that points to the node.
+ * node: the node to remove.
+ */
+static void unlink_node(HT * ht, HTNode ** link, HTNode * node) {
+  HT_STORE_RELEASE(link, node->next);
+
+  if(ht->ebr != NULL) {
+    ebr_retire(ht->ebr, node, free);
+  } else {
+    node_free(ht, node);
+  }
+  ht->numItems--;
 }
 
 /**
- * Iterates to the end of list and appends node.
- * list: list that will receive node.
- * node: node that will be appended.
+ * Places the node at the head of the linked list at its hashed index in
+ * the current bucket array. Uses the hash stored in the node, so the key
+ * is never read. Does not change the item count.
+ * ht: the instance of the HT to add the node to.
+ * node: the node to link into the hashtable.
  */
-static void append_node(HTNode * list, HTNode * node) {
-  HTNode * tail = node_list_last(list);
-  tail->next = node;
+static void link_node(HT * ht, HTNode * node) {
+  int i = bucket_index(node->hash, ht->tableSize, ht->indexMask);
+
+  node->next = ht->table[i];
+
+  /* the node must be complete before lock-free readers can reach it */
+  HT_STORE_RELEASE(&ht->table[i], node);
 }
 
 /**
- * Hashes the key in the node structure and then places the node in the
- * linked list at the hashed index.
+ * Places a new node in the hashtable and counts it.
  * ht: the instance of the HT to add the node to.
  * node: the node to add to the hashtable.
  */
 static void put_node(HT * ht, HTNode * node) {
+  link_node(ht, node);
+  ht->numItems++;
+}
 
-  int i = hash_to_index(ht, node->key, node->keySize);
+/**
+ * Moves every node in one bucket of the old array into the current one.
+ * ht: the hashtable instance, which must be mid-rehash.
+ * i: the index of the old bucket.
+ */
+static void migrate_bucket(HT * ht, int i) {
+  HTNode * node = ht->oldTable[i];
 
-  /* if list exists at index, append to the end */
-  if(ht->table[i] != NULL) {
-    append_node(ht->table[i], node);
-  } else {
+  while(node != NULL) {
+    HTNode * currentNode = node;
 
-    /* create new list/head */
-    ht->table[i] = node;
+    node = node->next;
+    link_node(ht, currentNode);
   }
+  ht->oldTable[i] = NULL;
+}
 
-  node->next = NULL;
-  ht->numItems++;
+/**
+ * Performs one bounded step of an incremental rehash, migrating at most
+ * rehashStep non-empty buckets and visiting at most ten times as many
+ * empty ones. Frees the old array once it has been drained.
+ * ht: the hashtable instance.
+ */
+static void rehash_step(HT * ht) {
+  int moved = 0;
+  int emptyVisits = ht->rehashStep * 10;
+
+  while(moved < ht->rehashStep && ht->rehashIndex < ht->oldTableSize) {
+    if(ht->oldTable[ht->rehashIndex] == NULL) {
+      ht->rehashIndex++;
+      if(--emptyVisits == 0) {
+	break;
+      }
+      continue;
+    }
+
+    migrate_bucket(ht, ht->rehashIndex);
+    ht->rehashIndex++;
+    moved++;
+  }
+
+  if(ht->rehashIndex == ht->oldTableSize) {
+    free(ht->oldTable);
+    ht->oldTable = NULL;
+  }
+}
+
+/**
+ * Completes an in progress incremental rehash, if any.
+ * ht: the hashtable instance.
+ */
+static void rehash_finish(HT * ht) {
+  if(ht->oldTable == NULL) {
+    return;
+  }
+
+  for(; ht->rehashIndex < ht->oldTableSize; ht->rehashIndex++) {
+    if(ht->oldTable[ht->rehashIndex] != NULL) {
+      migrate_bucket(ht, ht->rehashIndex);
+    }
+  }
+
+  free(ht->oldTable);
+  ht->oldTable = NULL;
+}
+
+/**
+ * Creates a read view of a bucket array.
+ * returns: the view, or NULL on memory allocation error.
+ */
+static HTReadView * view_new(HTNode ** heads, int size) {
+  HTReadView * view = (HTReadView*)malloc(sizeof(HTReadView));
+
+  if(view != NULL) {
+    view->heads = heads;
+    view->size = size;
+    view->mask = index_mask(size);
+  }
+
+  return view;
+}
+
+/**
+ * Frees a read view, its bucket array and every node linked in it. Used
+ * as the EBR free function for replaced views.
+ */
+static void view_free(void * ptr) {
+  HTReadView * view = (HTReadView*)ptr;
+  int i;
+
+  for(i = 0; i < view->size; i++) {
+    HTNode * node = view->heads[i];
+
+    while(node != NULL) {
+      HTNode * next = node->next;
+
+      free(node);
+      node = next;
+    }
+  }
+
+  free(view->heads);
+  free(view);
+}
+
+/**
+ * Rehash for lock-free read mode. Readers may be walking the old chains,
+ * so rather than relinking nodes this links copies of them into the new
+ * array, publishes it, and retires the old array along with its nodes.
+ * ht: the instance of hashtable to modify.
+ * newSize: the new length for the hashtable array.
+ */
+static bool rehash_published(HT * ht, size_t newSize) {
+  HTReadView * oldView = ht->readView;
+  HTReadView * newView;
+  HTNode ** newTable = calloc(sizeof(HTNode*), newSize);
+  int i;
+
+  if(newTable == NULL) {
+    return false;
+  }
+
+  newView = view_new(newTable, newSize);
+  if(newView == NULL) {
+    free(newTable);
+    return false;
+  }
+
+  for(i = 0; i < ht->tableSize; i++) {
+    HTNode * node;
+
+    for(node = ht->table[i]; node != NULL; node = node->next) {
+      HTNode * copy = ht_node_alloc(HT_NODE_KEY(node), node->keySize,
+				    node->hash, &node->value);
+      int j;
+
+      /* memory alloc error, drop the copies and keep the old table */
+      if(copy == NULL) {
+	view_free(newView);
+	return false;
+      }
+
+      j = bucket_index(copy->hash, newSize, newView->mask);
+      copy->next = newTable[j];
+      newTable[j] = copy;
+    }
+  }
+
+  set_table_size(ht, newSize);
+  ht->table = newTable;
+  HT_STORE_RELEASE(&ht->readView, newView);
+  ebr_retire(ht->ebr, oldView, view_free);
+
+  return true;
 }
 
 /**
- * Rehashes the specified HT to the new array size.
+ * Rehashes the specified HT to the new array size. If the table has a
+ * rehashStep, this only installs the new array and the nodes are moved
+ * over by rehash_step() during later puts and gets.
  * ht: the instance of hashtable to modify.
  * newSize: the new length for the hashtable array.
+ * returns: false on memory allocation error, or if newSize is over
+ * HT_MAX_TABLE_SIZE, and the table is unchanged.
  */
 static bool rehash_table(HT * ht, size_t newSize) {
+  clock_t start = HT_STAT_CLOCK();
   int i = 0;
-  HTNode ** oldTable = ht->table;
-  size_t oldSize = ht->tableSize;
+  HTNode ** oldTable;
+  size_t oldSize;
+  unsigned int oldIndexMask;
+  HTNode ** newTable;
 
-  /* reset table */
-  ht->tableSize = newSize;
-  ht->table = calloc(sizeof(HTNode*), newSize);
-  ht->numItems = 0;
+  if(newSize < 1 || newSize > HT_MAX_TABLE_SIZE) {
+    return false;
+  }
 
-  /* memory alloc error */
-  if(ht->table == NULL) {
+  if(ht->ebr != NULL) {
+    if(!rehash_published(ht, newSize)) {
+      return false;
+    }
+    HT_STAT_REHASHED(ht, start);
+    return true;
+  }
+
+  newTable = calloc(sizeof(HTNode*), newSize);
+
+  /* memory alloc error, leave the old table in place */
+  if(newTable == NULL) {
     return false;
   }
 
+  /* only one migration can be in flight at a time */
+  rehash_finish(ht);
+
+  oldTable = ht->table;
+  oldSize = ht->tableSize;
+  oldIndexMask = ht->indexMask;
+
+  /* reset table */
+  set_table_size(ht, newSize);
+  ht->table = newTable;
+
+  /* incremental mode: keep both arrays live and migrate gradually */
+  if(ht->rehashStep > 0) {
+    ht->oldTable = oldTable;
+    ht->oldTableSize = oldSize;
+    ht->oldIndexMask = oldIndexMask;
+    ht->rehashIndex = 0;
+    HT_STAT_REHASHED(ht, start);
+    return true;
+  }
+
   /* iterate the list heads */
   for(i = 0; i < oldSize; i++) {
     HTNode * node = oldTable[i];
@@ -130,44 +375,431 @@ static bool rehash_table(HT * ht, size_t newSize) {
       HTNode * currentNode = node;
 
       node = node->next;
-      put_node(ht, currentNode);
+      link_node(ht, currentNode);
     }
   }
 
   free(oldTable);
+  HT_STAT_REHASHED(ht, start);
   return true;
 }
 
 /**
- * Checks the loading of the hashtable. If hashtable is loaded beyond load
- * factor, rehash_table is called, expanding table by ht->blockSize.
+ * Growth policy that doubles the table, keeping it a power of two so that
+ * hashes can be masked to an index. This is the default policy.
+ * tableSize: the current number of buckets.
+ * blockSize: ignored.
+ * minSize: the minimum number of buckets required.
+ * returns: the new number of buckets, at most HT_MAX_TABLE_SIZE.
+ */
+int ht_growth_double(int tableSize, int blockSize, int minSize) {
+  int newSize = 1;
+
+  while((newSize < minSize || newSize <= tableSize)
+	&& newSize < HT_MAX_TABLE_SIZE) {
+    newSize <<= 1;
+  }
+  return newSize;
+}
+
+/**
+ * Growth policy that adds blockSize buckets at a time. This was the only
+ * behavior before growth policies were added. Building a table of N items
+ * with it costs O(N^2 / blockSize) rehash work, so prefer ht_growth_double.
+ * tableSize: the current number of buckets.
+ * blockSize: the number of buckets to add per step.
+ * minSize: the minimum number of buckets required.
+ * returns: the new number of buckets, at most HT_MAX_TABLE_SIZE.
+ */
+int ht_growth_linear(int tableSize, int blockSize, int minSize) {
+  int steps;
+
+  if(blockSize < 1) {
+    blockSize = 1;
+  }
+  if(minSize > HT_MAX_TABLE_SIZE || tableSize >= HT_MAX_TABLE_SIZE
+     || blockSize > HT_MAX_TABLE_SIZE - tableSize) {
+    return HT_MAX_TABLE_SIZE;
+  }
+
+  steps = (minSize - tableSize + blockSize - 1) / blockSize;
+  if(steps > (HT_MAX_TABLE_SIZE - tableSize) / blockSize) {
+    return HT_MAX_TABLE_SIZE;
+  }
+  return tableSize + (steps > 1 ? steps : 1) * blockSize;
+}
+
+/**
+ * Computes the number of buckets needed to hold numItems without
+ * exceeding the load factor. Sizes past HT_MAX_TABLE_SIZE come back as
+ * HT_MAX_TABLE_SIZE + 1, which no table can reach.
+ */
+static int buckets_for_items(HT * ht, int numItems) {
+  double buckets = numItems / ht->loadFactor + 1;
+
+  if(buckets > HT_MAX_TABLE_SIZE) {
+    return HT_MAX_TABLE_SIZE + 1;
+  }
+  return (int)buckets;
+}
+
+/**
+ * Computes the smallest table that holds numItems, keeping the default
+ * policy's tables a power of two.
+ */
+static int fit_size(HT * ht, int numItems) {
+  int minSize = buckets_for_items(ht, numItems);
+
+  if(ht->growthPolicy == ht_growth_double) {
+    return ht_growth_double(0, ht->blockSize, minSize);
+  }
+  return minSize;
+}
+
+/**
+ * Checks the loading of the hashtable after an insert. If hashtable is
+ * loaded beyond load factor, rehash_table is called, expanding table by the
+ * growth policy.
  * ht: the hashtable instance.
  */
 static void check_load_factor(HT * ht) {
+
+  /* let an incremental rehash drain before starting another one */
+  if(ht->oldTable != NULL) {
+    return;
+  }
+
   if(ht->numItems >= (ht->tableSize * ht->loadFactor)) {
-    rehash_table(ht, ht->tableSize + ht->blockSize);
+    int newSize = ht->growthPolicy(ht->tableSize, ht->blockSize,
+				   buckets_for_items(ht, ht->numItems));
+
+    /* a table at HT_MAX_TABLE_SIZE just gets more loaded */
+    if(newSize > ht->tableSize) {
+      rehash_table(ht, newSize);
+    }
   }
 }
 
+/**
+ * Checks the loading of the hashtable after a removal. If it has a
+ * shrinkFactor and is loaded below it, the table is shrunk, though never
+ * below its initial or reserved size.
+ * ht: the hashtable instance.
+ */
+static void check_shrink(HT * ht) {
+  int newSize;
+
+  if(ht->oldTable != NULL
+     || ht->numItems >= ht->tableSize * ht->shrinkFactor) {
+    return;
+  }
+
+  /* land at half the load factor, so it takes as many inserts to grow
+   * again as it would to double
+   */
+  newSize = fit_size(ht, ht->numItems * 2);
+  if(newSize < ht->minTableSize) {
+    newSize = ht->minTableSize;
+  }
+  if(newSize < ht->tableSize) {
+    rehash_table(ht, newSize);
+  }
+}
+
+/**
+ * Grows the table so that numItems items fit without any further rehashing.
+ * Call before a bulk load. Tables never shrink through this function, and
+ * a table with a shrinkFactor won't shrink below the reserved size.
+ * ht: the hashtable instance.
+ * numItems: the number of items the table must hold.
+ * returns: false on memory allocation error, or if numItems needs more
+ * than HT_MAX_TABLE_SIZE buckets, and the table is unchanged.
+ */
+bool ht_reserve(HT * ht, int numItems) {
+  int minSize;
+  int newSize;
+
+  if(ht->ops != NULL) {
+    return ht->ops->reserve(ht, numItems);
+  }
+
+  minSize = buckets_for_items(ht, numItems);
+  if(minSize > ht->tableSize) {
+    newSize = ht->growthPolicy(ht->tableSize, ht->blockSize, minSize);
+    if(newSize < minSize || !rehash_table(ht, newSize)) {
+      return false;
+    }
+  }
+
+  /* removals may shrink the table, but not back below this */
+  newSize = fit_size(ht, numItems);
+  if(newSize > ht->minTableSize && newSize <= ht->tableSize) {
+    ht->minTableSize = newSize;
+  }
+  return true;
+}
+
+/**
+ * Frees the nodes in a bucket array that were allocated from the heap,
+ * leaving pooled ones for pool_free().
+ */
+static void free_heap_nodes(HT * ht, HTNode ** table, int tableSize) {
+  int i;
+
+  for(i = 0; i < tableSize; i++) {
+    HTNode * node = table[i];
+
+    while(node != NULL) {
+      HTNode * next = node->next;
+
+      if(!node_is_pooled(ht, node->keySize)) {
+	free(node);
+      }
+      node = next;
+    }
+  }
+}
+
+/**
+ * Copies every node to fresh memory in bucket order, so that walking a
+ * chain, or the whole table, touches neighbouring memory. Pooled nodes go
+ * to a new pool and the old pool's slabs, including those only holding
+ * removed nodes, are freed.
+ * ht: the hashtable instance, which must not be mid-rehash.
+ * returns: false on memory allocation error, and the table is unchanged.
+ */
+static bool repack_nodes(HT * ht) {
+  HTNode ** newTable = calloc(sizeof(HTNode*), ht->tableSize);
+  Pool * newPool = NULL;
+  int i;
+
+  if(newTable == NULL) {
+    return false;
+  }
+
+  if(ht->nodePool != NULL) {
+    newPool = pool_new(pool_item_size(ht->nodePool),
+		       ht->nodePool->itemsPerSlab);
+    if(newPool == NULL) {
+      free(newTable);
+      return false;
+    }
+  }
+
+  for(i = 0; i < ht->tableSize; i++) {
+    HTNode ** link = &newTable[i];
+    HTNode * node;
+
+    for(node = ht->table[i]; node != NULL; node = node->next) {
+      size_t size = sizeof(HTNode) + node->keySize;
+      HTNode * copy = node_is_pooled(ht, node->keySize)
+	? (HTNode*)pool_alloc(newPool) : (HTNode*)malloc(size);
+
+      /* memory alloc error, drop the copies and keep the old nodes */
+      if(copy == NULL) {
+	free_heap_nodes(ht, newTable, ht->tableSize);
+	if(newPool != NULL) {
+	  pool_free(newPool);
+	}
+	free(newTable);
+	return false;
+      }
+
+      memcpy(copy, node, size);
+      copy->next = NULL;
+      *link = copy;
+      link = &copy->next;
+    }
+  }
+
+  free_heap_nodes(ht, ht->table, ht->tableSize);
+  if(ht->nodePool != NULL) {
+    pool_free(ht->nodePool);
+  }
+  free(ht->table);
+
+  ht->table = newTable;
+  ht->nodePool = newPool;
+  return true;
+}
+
+/**
+ * Shrinks or grows the table to the smallest size that holds its items,
+ * then moves every node to fresh memory in bucket order. Lets a long lived
+ * table give back the memory of a past peak. Call it after a burst of
+ * removals; it costs about as much as a rehash. Pointers returned by
+ * ht_get_or_insert() are invalidated. HT_ENGINE_SWISS and HT_ENGINE_CUCKOO
+ * only resize.
+ * ht: the hashtable instance.
+ * returns: false on memory allocation error. The table is still valid,
+ * but may not have been compacted.
+ */
+bool ht_compact(HT * ht) {
+  int newSize;
+
+  if(ht->ops != NULL) {
+    return ht->ops->compact(ht);
+  }
+
+  rehash_finish(ht);
+  newSize = fit_size(ht, ht->numItems);
+
+  /* lock-free read mode rehashes by copying nodes, which already repacks */
+  if(ht->ebr != NULL) {
+    return rehash_table(ht, newSize);
+  }
+
+  if(newSize != ht->tableSize) {
+    if(!rehash_table(ht, newSize)) {
+      return false;
+    }
+    rehash_finish(ht);
+  }
+
+  return repack_nodes(ht);
+}
+
 /**
  * Creates a new hashtable.
  * tableSize: initial size of the hashtable's array. (number of "buckets")
+ * Rounded up to a power of two by the default growth policy.
  * blockSize: the number by which tableSize will be increased each time table is
- * rehashed.
+ * rehashed, when using the ht_growth_linear policy.
  * loadFactor: A value defining a percentage of load upon which the hashtable
  * will be expanded. For example, if the hashtable has loadFactor of 0.75f and
- * is 100 buckets in size, it will automatically add another blockSize buckets
- * when 75 of the 100 buckets are full.
+ * is 128 buckets in size, it will automatically double to 256 buckets
+ * when 96 of the 128 buckets are full.
  * returns: pointer to a new HT struct.
  */
 HT * ht_new(int tableSize, int blockSize, float loadFactor) {
-  HT * ht = calloc(1, sizeof(HT));
+  return ht_new_ex(tableSize, blockSize, loadFactor, NULL);
+}
+
+/**
+ * Fills an options struct with the defaults used by ht_new().
+ * options: the options struct to initialize.
+ */
+void ht_options_init(HTOptions * options) {
+  memset(options, 0, sizeof(HTOptions));
+  options->engine = HT_ENGINE_CHAINED;
+}
+
+/**
+ * Creates a new hashtable with the given options. Arguments are the same as
+ * ht_new().
+ * options: the creation options, or NULL for the defaults.
+ * HT_ENGINE_SWISS rounds tableSize up to a power of two multiple of 16,
+ * always grows by doubling, and clamps loadFactor to 0.875.
+ * HT_ENGINE_ORDERED rounds tableSize up to a power of two, clamps
+ * loadFactor to 2/3, and iterates in the order keys were first inserted.
+ * HT_ENGINE_CUCKOO rounds tableSize up to a power of two multiple of 4,
+ * always grows by doubling, and clamps loadFactor to 0.95. Lookups read at
+ * most two buckets, and hash keys a second time with lookup3 when the
+ * first bucket misses.
+ * HT_ENGINE_MAPPED and HT_ENGINE_FROZEN tables only come from
+ * ht_open_mmap() and ht_freeze(), and asking for one here fails.
+ *
+ * options->hashFunc picks the hash function: hash_lookup3 (the default),
+ * hash_wy, hash_crc32c, or any HashFunc. Set options->randomSeed for
+ * tables holding keys chosen by untrusted users, so that a set of keys
+ * built to land in one chain only does so for one run of one table. Use
+ * it with hash_lookup3 or hash_wy: keys that collide under hash_crc32c
+ * collide under every seed, so CRC32C gives no flooding resistance.
+ *
+ * If options->ebr is set, ht_get_raw_key(), ht_get() and ht_get_many() take
+ * no locks and may run on any number of threads at the same time as one
+ * writer. Readers must call them between ebr_enter() and ebr_exit() on the
+ * same EBR, and must not iterate. Writers (puts, removes, ht_reserve,
+ * iteration) must still be serialized by the caller. Removed and replaced
+ * nodes are retired to the EBR rather than freed. This mode only works with
+ * HT_ENGINE_CHAINED, without rehashStep and without nodesPerSlab, and only
+ * in builds with DATASTRUCT_ENABLE_EBR, see build_config.h.
+ * returns: pointer to a new HT struct, or NULL on memory allocation error,
+ * a chained tableSize over HT_MAX_TABLE_SIZE, or an unsupported combination
+ * of options.
+ */
+HT * ht_new_ex(int tableSize, int blockSize, float loadFactor,
+	       HTOptions * options) {
+  HTOptions defaults;
+  HT * ht;
+
+  if(options == NULL) {
+    ht_options_init(&defaults);
+    options = &defaults;
+  }
+
+  /* lock-free reads need nodes that can be retired with free(), and a
+   * table that is never relinked in place
+   */
+  if(options->ebr != NULL && (options->engine != HT_ENGINE_CHAINED
+			      || options->rehashStep > 0
+			      || options->nodesPerSlab > 0)) {
+    return NULL;
+  }
+#ifndef DATASTRUCT_ENABLE_EBR
+  if(options->ebr != NULL) {
+    return NULL;
+  }
+#endif /* DATASTRUCT_ENABLE_EBR */
+
+  ht = calloc(1, sizeof(HT));
 
   /* check for successful memory allocation of container*/
   if(ht == NULL) {
     return NULL;
   }
 
+  ht->tableSize = tableSize;
+  ht->blockSize = blockSize;
+  ht->loadFactor = loadFactor;
+  ht->engine = options->engine;
+  ht->growthPolicy = options->growthPolicy;
+  ht->rehashStep = options->rehashStep;
+  ht->hashFunc = options->hashFunc != NULL ? options->hashFunc : hash_lookup3;
+  ht->hashSeed = options->randomSeed ? hash_random_seed() : options->hashSeed;
+
+  switch(options->engine) {
+  case HT_ENGINE_SWISS:
+    ht->ops = &ht_swiss_ops;
+    break;
+  case HT_ENGINE_ORDERED:
+    ht->ops = &ht_ordered_ops;
+    break;
+  case HT_ENGINE_MAPPED:
+  case HT_ENGINE_FROZEN:
+
+    /* only ht_open_mmap() and ht_freeze() make these */
+    free(ht);
+    return NULL;
+  case HT_ENGINE_CUCKOO:
+    ht->ops = &ht_cuckoo_ops;
+    break;
+  default:
+    break;
+  }
+
+  /* alternate engines allocate their own storage */
+  if(ht->ops != NULL) {
+    if(!ht->ops->init(ht, tableSize)) {
+      free(ht);
+      return NULL;
+    }
+    return ht;
+  }
+
+  /* the default policy keeps the table a power of two from the start */
+  if(ht->growthPolicy == NULL) {
+    ht->growthPolicy = ht_growth_double;
+    tableSize = ht_growth_double(0, blockSize, tableSize);
+  }
+  if(tableSize > HT_MAX_TABLE_SIZE) {
+    free(ht);
+    return NULL;
+  }
+  set_table_size(ht, tableSize);
+  ht->minTableSize = tableSize;
+  ht->shrinkFactor = options->shrinkFactor;
+
   /* alloc array of linked list pointers */
   ht->table = calloc(1, sizeof(HTNode*) * tableSize);
   if(ht->table == NULL) {
@@ -175,9 +807,27 @@ HT * ht_new(int tableSize, int blockSize, float loadFactor) {
     return NULL;
   }
 
-  ht->tableSize = tableSize;
-  ht->blockSize = blockSize;
-  ht->loadFactor = loadFactor;
+  /* publish the first bucket array to lock-free readers */
+  if(options->ebr != NULL) {
+    ht->ebr = options->ebr;
+    ht->readView = view_new(ht->table, ht->tableSize);
+    if(ht->readView == NULL) {
+      free(ht->table);
+      free(ht);
+      return NULL;
+    }
+  }
+
+  /* nodes with short keys come from slabs if requested */
+  if(options->nodesPerSlab > 0) {
+    ht->nodePool = pool_new(sizeof(HTNode) + HT_POOL_KEY_SIZE,
+			    options->nodesPerSlab);
+    if(ht->nodePool == NULL) {
+      free(ht->table);
+      free(ht);
+      return NULL;
+    }
+  }
 
   return ht;
 }
@@ -186,30 +836,24 @@ HT * ht_new(int tableSize, int blockSize, float loadFactor) {
  * Helper method that exchanges old values in the hashtable with new
  * ones.
  * ht: hashtable instance.
+ * bucket: the head pointer of the linked list holding curNode.
  * newValue: the new value to set.
+ * curNode: the node holding the old value.
  * prevNode: the node before the current node.
  * deleteValOnNull: If true, deletes the value if newValue is null.
- * i: current linked list index
  */
-static void exchange_values(HT * ht, DSValue * newValue,
+static void exchange_values(HT * ht, HTNode ** bucket, DSValue * newValue,
 			    HTNode * curNode, HTNode * prevNode,
-			    bool deleteValOnNull, int i) {
+			    bool deleteValOnNull) {
   /* if newValue is provided, store it in the pre-exising node */
   if(newValue != NULL) {
-    memcpy(&ht->table[i]->value, newValue, sizeof(DSValue));
+    memcpy(&curNode->value, newValue, sizeof(DSValue));
   } else if(deleteValOnNull) {
 
-    /* newValue is NULL, delete the value */
-    if(prevNode != NULL) {
-      prevNode->next = curNode->next;
-      node_free(curNode);
-    } else {
-
-      /* at head, delete list */
-      node_free(ht->table[i]);
-      ht->table[i] = NULL;
-    }
-    ht->numItems--;
+    /* newValue is NULL, delete the value. at head, the next node becomes
+     * the head
+     */
+    unlink_node(ht, prevNode != NULL ? &prevNode->next : bucket, curNode);
   }
 }
 
@@ -227,7 +871,7 @@ static void copy_node_key(HTNode * currentNode, void * keyBuffer,
       ? keyBufferLen:currentNode->keySize;
 
     /* copy only as much of the key as will fit in the buffer */
-    memcpy(keyBuffer, currentNode->key, writeSize);
+    memcpy(keyBuffer, HT_NODE_KEY(currentNode), writeSize);
 
     if(keyLen != NULL) {
       *keyLen = currentNode->keySize;
@@ -247,10 +891,78 @@ static void copy_node_value(HTNode * currentNode, DSValue * value) {
   }
 }
 
+/**
+ * Searches a linked list of nodes for a key.
+ * head: the first node in the list.
+ * hash: the key's hash.
+ * key: the key to look for.
+ * keySize: the number of bytes in the key buffer that are to be
+ * used as the key.
+ * prevNode: recv. the node before the one found, or NULL if it is the head.
+ * returns: the node holding the key, or NULL if it isn't in the list.
+ */
+HTNode * ht_chain_find(HTNode * head, uint32_t hash, void * key,
+		       size_t keySize, HTNode ** prevNode) {
+  HTNode * curNode = head;
+
+  *prevNode = NULL;
+
+  /* while tokens remain, keep going */
+  while(curNode != NULL) {
+
+    /* if the keys are the same... comparing the stored hash first means the
+     * key memory of non-matching nodes is never touched
+     */
+    if(curNode->hash == hash && curNode->keySize == keySize
+       && memcmp(key, HT_NODE_KEY(curNode), keySize) == 0) {
+      return curNode;
+    }
+
+    /* advance list */
+    *prevNode = curNode;
+    curNode = curNode->next;
+  }
+
+  return NULL;
+}
+
+/**
+ * ht_chain_find() for this table's own chains, which also counts the nodes
+ * visited and keys compared when statistics are enabled.
+ */
+static HTNode * chain_find(HT * ht, HTNode * head, uint32_t hash, void * key,
+			   size_t keySize, HTNode ** prevNode) {
+#ifdef DATASTRUCT_ENABLE_STATS
+  HTNode * curNode = head;
+
+  *prevNode = NULL;
+
+  while(curNode != NULL) {
+    HT_STAT_ADD(ht, nodesVisited, 1);
+
+    if(curNode->hash == hash && curNode->keySize == keySize) {
+      HT_STAT_ADD(ht, keyCompares, 1);
+
+      if(memcmp(key, HT_NODE_KEY(curNode), keySize) == 0) {
+	return curNode;
+      }
+    }
+
+    *prevNode = curNode;
+    curNode = curNode->next;
+  }
+
+  return NULL;
+#else
+  return ht_chain_find(head, hash, key, keySize, prevNode);
+#endif /* DATASTRUCT_ENABLE_STATS */
+}
+
 /**
  * Checks the specified linked list for a prexisting value.
  * ht: the instance of hashtable.
- * i: the index of the linked list in which to look.
+ * bucket: the head pointer of the linked list in which to look.
+ * hash: the key's hash.
  * key: the key pertaining to the value that we are looking for.
  * keySize: the number of bytes in the key buffer that are to be
  * used as the key.
@@ -260,66 +972,294 @@ static void copy_node_value(HTNode * currentNode, DSValue * value) {
  * to key.
  * returns: true if the value existed and false otherwise.
  */
-static bool find_value(HT * ht, int i, void * key, size_t keySize,
+static bool find_value(HT * ht, HTNode ** bucket, uint32_t hash,
+		       void * key, size_t keySize,
 		       DSValue * newValue, DSValue * oldValue,
 		       bool deleteValOnNull) {
-  HTNode * curNode = ht->table[i];
-  HTNode * prevNode = NULL;
+  HTNode * prevNode;
+  HTNode * curNode = chain_find(ht, *bucket, hash, key, keySize, &prevNode);
 
-  /* while tokens remain, keep going */
-  while(curNode != NULL) {
+  if(curNode == NULL) {
+    return false;
+  }
+
+  /* if oldValue buffer is provided, copy previous value to it */
+  copy_node_value(curNode, oldValue);
+
+  /* exchange old value with new one */
+  exchange_values(ht, bucket, newValue, curNode, prevNode, deleteValOnNull);
+
+  return true;
+}
+
+/**
+ * Looks for a key in the current bucket array and, during an incremental
+ * rehash, in the old one as well. Arguments are the same as find_value().
+ * returns: true if the value existed and false otherwise.
+ */
+static bool find_in_tables(HT * ht, uint32_t hash, void * key, size_t keySize,
+			   DSValue * newValue, DSValue * oldValue,
+			   bool deleteValOnNull) {
+  int i;
+
+  if(ht->oldTable != NULL) {
+    i = bucket_index(hash, ht->oldTableSize, ht->oldIndexMask);
+
+    if(ht->oldTable[i] != NULL
+       && find_value(ht, &ht->oldTable[i], hash, key, keySize, newValue,
+		     oldValue, deleteValOnNull)) {
+      return true;
+    }
+  }
+
+  i = bucket_index(hash, ht->tableSize, ht->indexMask);
+
+  /* if there is a linked list at the hashed index, try to find the value */
+  if(ht->table[i] != NULL) {
+    return find_value(ht, &ht->table[i], hash, key, keySize, newValue,
+		      oldValue, deleteValOnNull);
+  }
+
+  return false;
+}
+
+/**
+ * Fills in a freshly allocated node and copies the key in after it.
+ */
+static void node_init(HTNode * node, void * key, size_t keySize,
+		      uint32_t hash, DSValue * value) {
+  memcpy(HT_NODE_KEY(node), key, keySize);
+  node->keySize = keySize;
+  node->hash = hash;
+  memcpy(&node->value, value, sizeof(DSValue));
+  node->next = NULL;
+}
+
+/**
+ * Allocates a node and its key from the heap. Free it with free().
+ * key: the key to store in the new node.
+ * keySize: the number of bytes from key to store in the node.
+ * hash: the key's hash.
+ * value: the value to copy into the node.
+ * returns: a new unlinked node, or NULL on memory allocation error.
+ */
+HTNode * ht_node_alloc(void * key, size_t keySize, uint32_t hash,
+		       DSValue * value) {
+  HTNode * node = malloc(sizeof(HTNode) + keySize);
+
+  if(node != NULL) {
+    node_init(node, key, keySize, hash, value);
+  }
+
+  return node;
+}
+
+/**
+ * Creates a new hashtable node. The key is copied into the same allocation,
+ * directly after the node, so a lookup that reaches the node finds its key
+ * on the same cache line for short keys. If the table has a node pool,
+ * nodes with keys up to HT_POOL_KEY_SIZE bytes are taken from it.
+ * ht: the hashtable the node will belong to.
+ * key: the key to store in the new node.
+ * keySize: the number of bytes from key to store in the node.
+ * hash: the key's hash, kept so that rehashing never rereads the key.
+ * value: the value to copy into the node.
+ * returns: a new node, or NULL on memory allocation error.
+ */
+static HTNode * node_new(HT * ht, void * key, size_t keySize, uint32_t hash,
+			 DSValue * value, HTNode * next) {
+  HTNode * node;
+
+  if(node_is_pooled(ht, keySize)) {
+    node = (HTNode*)pool_alloc(ht->nodePool);
+    if(node != NULL) {
+      node_init(node, key, keySize, hash, value);
+    }
+  } else {
+    node = ht_node_alloc(key, keySize, hash, value);
+
+    if(node != NULL && ht->nodePool != NULL) {
+      ht->heapNodes++;
+    }
+  }
+
+  if(node != NULL) {
+    node->next = next;
+  }
+
+  return node;
+}
+
+/**
+ * Checks to make sure that a pointer to a boolean isn't null and then
+ * copies the new boolean to it.
+ * outValue: pointer to the recv. buffer.
+ * inValue: the value to set the outValue to.
+ */
+static void copy_boolean(bool * outValue, bool inValue) {
+  if(outValue != NULL) {
+    *outValue = inValue;
+  }
+}
+
+/**
+ * Stores a value in a table in lock-free read mode. Readers may be copying
+ * a node's value at any time, so a node is never changed once linked: an
+ * update links a new node in place of the old one and retires the old one.
+ * Arguments are the same as ht_put_hashed().
+ */
+static bool put_published(HT * ht, uint32_t hash, void * key, size_t keySize,
+			  DSValue * newValue, DSValue * oldValue,
+			  bool * prevValue) {
+  HTNode ** bucket = &ht->table[bucket_index(hash, ht->tableSize,
+					     ht->indexMask)];
+  HTNode * newNode = NULL;
+  HTNode * prevNode;
+  HTNode * curNode;
+
+  if(newValue != NULL) {
+    newNode = node_new(ht, key, keySize, hash, newValue, NULL);
+    if(newNode == NULL) {
+      return false;
+    }
+  }
+
+  curNode = chain_find(ht, *bucket, hash, key, keySize, &prevNode);
+  copy_boolean(prevValue, curNode != NULL);
+
+  if(curNode == NULL) {
+    if(newNode != NULL) {
+      put_node(ht, newNode);
+    }
+  } else {
+    copy_node_value(curNode, oldValue);
+
+    if(newNode != NULL) {
+      newNode->next = curNode->next;
+      HT_STORE_RELEASE(prevNode != NULL ? &prevNode->next : bucket, newNode);
+      ebr_retire(ht->ebr, curNode, free);
+    } else {
+      unlink_node(ht, prevNode != NULL ? &prevNode->next : bucket, curNode);
+      check_shrink(ht);
+    }
+  }
+
+  /* expand table if neccessary */
+  if(curNode == NULL && newNode != NULL) {
+    check_load_factor(ht);
+  }
+
+  return true;
+}
+
+/**
+ * Stores a value in a chained hashtable. Arguments are the same as
+ * ht_put_hashed().
+ */
+static bool chained_put(HT * ht, uint32_t hash, void * key, size_t keySize,
+			DSValue * newValue, DSValue * oldValue,
+			bool * prevValue) {
+  bool oldValueExists = false;
+
+  if(ht->ebr != NULL) {
+    return put_published(ht, hash, key, keySize, newValue, oldValue,
+			 prevValue);
+  }
+
+  /* move a few buckets along if a rehash is in progress */
+  if(ht->oldTable != NULL) {
+    rehash_step(ht);
+  }
+
+  oldValueExists = find_in_tables(ht, hash, key, keySize,
+				  newValue, oldValue, true);
 
-    /* if the keys are the same... */
-    if(curNode->keySize == keySize && memcmp(key, curNode->key, keySize) == 0) {
+  copy_boolean(prevValue, oldValueExists);
 
-      /* if oldValue buffer is provided, copy previous value to it */
-      copy_node_value(curNode, oldValue);
+  if(!oldValueExists) {
+    if(newValue != NULL) {
 
-      /* exchange old value with new one */
-      exchange_values(ht, newValue, curNode, prevNode, deleteValOnNull, i);
+      HTNode * newNode = node_new(ht, key, keySize, hash, newValue, NULL);
+      if(newNode == NULL) {
+	return false;
+      }
 
-      return true;
+      put_node(ht, newNode);
+
+      /* expand table if neccessary */
+      check_load_factor(ht);
     }
-    /* advance list */
-    prevNode = curNode;
-    curNode = curNode->next;
+  } else if(newValue == NULL) {
+    check_shrink(ht);
   }
 
-  return false;
+  return true;
 }
 
 /**
- * Creates a new hashtable node.
- * key: the key to store in the new node.
- * keySize: the number of bytes from key to store in the node.
- * value: the value to copy into the node.
- * returns: a new node.
+ * Computes a key's hash the way this table does, for use with
+ * ht_get_hashed() and ht_put_hashed(). The hash can be reused with any
+ * table that has the same hash function and seed.
+ * ht: the hashtable instance.
+ * key: the key to hash.
+ * keySize: the number of bytes from key that are the key.
+ * returns: the key's hash.
  */
-static HTNode * node_new(void * key, size_t keySize, DSValue * value,
-				HTNode * next) {
-  HTNode * node = calloc(1, sizeof(HTNode));
+uint32_t ht_hash(HT * ht, void * key, size_t keySize) {
+  return hash_key(ht, key, keySize);
+}
 
-  if(node != NULL) {
-    node->key = calloc(keySize, 1);
-    memcpy(node->key, key, keySize);
-    node->keySize = keySize;
-    memcpy(&node->value, value, sizeof(DSValue));
-    node->next = next;
+/**
+ * Stores a value with whichever engine the table uses. Arguments are the
+ * same as ht_put_hashed().
+ */
+static bool engine_put(HT * ht, uint32_t hash, void * key, size_t keySize,
+		       DSValue * newValue, DSValue * oldValue,
+		       bool * prevValue) {
+
+  if(ht->ops != NULL) {
+    return ht->ops->put(ht, hash, key, keySize, newValue, oldValue,
+			prevValue);
   }
 
-  return node;
+  return chained_put(ht, hash, key, keySize, newValue, oldValue, prevValue);
 }
 
 /**
- * Checks to make sure that a pointer to a boolean isn't null and then
- * copies the new boolean to it.
- * outValue: pointer to the recv. buffer.
- * inValue: the value to set the outValue to.
+ * Stores a value under a key whose hash the caller already has. Same as
+ * ht_put_raw_key() without hashing the key.
+ * ht: the hashtable instance.
+ * hash: the key's hash, from ht_hash() on this table or one with the same
+ * hash function and seed. Any other hash makes the key unfindable.
+ * key: the key which the value will be hashed to.
+ * keySize: The number of bytes from key that will be used for the key.
+ * newValue: A pointer to a new value to store, or NULL to remove the key.
+ * oldValue: A buffer that will recv. the old value, or NULL.
+ * prevValue: recv. whether or not the key previously had a value, or NULL.
+ * return: true on success, or false on memory allocation error.
  */
-static void copy_boolean(bool * outValue, bool inValue) {
-  if(outValue != NULL) {
-    *outValue = inValue;
+bool ht_put_hashed(HT * ht, uint32_t hash, void * key, size_t keySize,
+		   DSValue * newValue, DSValue * oldValue, bool * prevValue) {
+  bool existed;
+
+  if(!HT_HAS_EXPIRIES(ht)) {
+    return engine_put(ht, hash, key, keySize, newValue, oldValue, prevValue);
+  }
+
+  /* an expired key is gone, so a put recreates it without an expiry, and
+   * a removed key takes its expiry with it
+   */
+  (void)ht_expire_if_due(ht, hash, key, keySize);
+  if(!engine_put(ht, hash, key, keySize, newValue, oldValue, &existed)) {
+    return false;
+  }
+
+  if(newValue == NULL || !existed) {
+    ht_expire_forget(ht, hash, key, keySize);
   }
+
+  copy_boolean(prevValue, existed);
+  return true;
 }
 
 /**
@@ -338,31 +1278,8 @@ static void copy_boolean(bool * outValue, bool inValue) {
  */
 bool ht_put_raw_key(HT * ht, void * key, size_t keySize,
 		    DSValue * newValue, DSValue * oldValue, bool *  prevValue) {
-  int i = hash_to_index(ht, key, keySize);
-  bool oldValueExists = false;
-
-  if(ht->table[i] != NULL) {
-    oldValueExists = find_value(ht, i, key, keySize, newValue, oldValue, true);
-  }
-
-  copy_boolean(prevValue, oldValueExists);
-
-  if(!oldValueExists) {
-    if(newValue != NULL) {
-
-      HTNode * newNode = node_new(key, keySize, newValue, NULL);
-      if(newNode == NULL) {
-	return false;
-      }
-
-      put_node(ht, newNode);
-    }
-  }
-
-  /* expand table if neccessary */
-  check_load_factor(ht);
-
-  return true;
+  return ht_put_hashed(ht, hash_key(ht, key, keySize), key, keySize,
+		       newValue, oldValue, prevValue);
 }
 
 /**
@@ -579,6 +1496,93 @@ bool ht_put_pointer(HT * ht, char * key, void * newValue, void ** oldValue, bool
 }
 #endif /* DATASTRUCT_ENABLE_POINTER */
 
+/**
+ * Gets a value from a table in lock-free read mode. Uses nothing but
+ * acquire loads, which pair with the release stores in link_node(),
+ * unlink_node(), put_published() and rehash_published(). The caller must
+ * be inside an EBR read section. Arguments are the same as ht_get_hashed().
+ */
+static bool get_published(HT * ht, uint32_t hash, void * key,
+			  size_t keySize, DSValue * value) {
+  HTReadView * view = HT_LOAD_ACQUIRE(&ht->readView);
+  HTNode * node = HT_LOAD_ACQUIRE(&view->heads[bucket_index(hash, view->size,
+							    view->mask)]);
+
+  while(node != NULL) {
+    if(node->hash == hash && node->keySize == keySize
+       && memcmp(key, HT_NODE_KEY(node), keySize) == 0) {
+      copy_node_value(node, value);
+      return true;
+    }
+    node = HT_LOAD_ACQUIRE(&node->next);
+  }
+
+  return false;
+}
+
+/**
+ * Counts a get and whether it hit. Lock-free readers run concurrently, so
+ * gets in that mode aren't counted.
+ */
+static void count_lookup(HT * ht, bool exists) {
+#ifdef DATASTRUCT_ENABLE_STATS
+  if(ht->ebr == NULL) {
+    ht->counters.lookups++;
+    if(exists) {
+      ht->counters.hits++;
+    } else {
+      ht->counters.misses++;
+    }
+  }
+#endif /* DATASTRUCT_ENABLE_STATS */
+}
+
+/**
+ * Gets a value from a chained hashtable. Arguments are the same as
+ * ht_get_hashed().
+ */
+static bool chained_get(HT * ht, uint32_t hash, void * key, size_t keySize,
+			DSValue * value) {
+
+  if(ht->ebr != NULL) {
+    return get_published(ht, hash, key, keySize, value);
+  }
+
+  /* move a few buckets along if a rehash is in progress */
+  if(ht->oldTable != NULL) {
+    rehash_step(ht);
+  }
+
+  return find_in_tables(ht, hash, key, keySize, NULL, value, false);
+}
+
+/**
+ * Gets a value under a key whose hash the caller already has. Same as
+ * ht_get_raw_key() without hashing the key.
+ * ht: the hashtable instance
+ * hash: the key's hash, from ht_hash() on this table or one with the same
+ * hash function and seed.
+ * key: the key at which the value will be looked up.
+ * keySize: the number of bytes from key to be used as the key.
+ * value: recv. the stored value if it exists, or NULL.
+ * returns: true if the specified value exists and false if it does not.
+ */
+bool ht_get_hashed(HT * ht, uint32_t hash, void * key, size_t keySize,
+		   DSValue * value) {
+  bool exists;
+
+  if(HT_HAS_EXPIRIES(ht) && ht_expire_if_due(ht, hash, key, keySize)) {
+    exists = false;
+  } else if(ht->ops != NULL) {
+    exists = ht->ops->get(ht, hash, key, keySize, value);
+  } else {
+    exists = chained_get(ht, hash, key, keySize, value);
+  }
+
+  count_lookup(ht, exists);
+  return exists;
+}
+
 /**
  * Gets a value hashed from hashtable using raw buffer as key.
  * ht: the hashtable instance
@@ -589,16 +1593,7 @@ bool ht_put_pointer(HT * ht, char * key, void * newValue, void ** oldValue, bool
  * returns: true if the specified value exists and false if it does not.
  */
 bool ht_get_raw_key(HT * ht, void * key, size_t keySize, DSValue * value) {
-
-  /* calculate array index */
-  int i = hash_to_index(ht, key, keySize);
-
-  /* if there is a linked list at the hashed index, try to get the value */
-  if(ht->table[i] != NULL) {
-    return find_value(ht, i, key, keySize, NULL, value, false);
-  }
-
-  return false;
+  return ht_get_hashed(ht, hash_key(ht, key, keySize), key, keySize, value);
 }
 
 /**
@@ -614,6 +1609,310 @@ bool ht_get(HT * ht, char * key, DSValue * value) {
   return ht_get_raw_key(ht, key, strlen(key) + 1, value);
 }
 
+/**
+ * Finds a key's node in a chained table, inserting it with a zeroed value
+ * if it is missing. Arguments are the same as ht_get_or_insert().
+ * returns: the key's node, or NULL on memory allocation error.
+ */
+static HTNode * chained_get_or_insert(HT * ht, uint32_t hash, void * key,
+				      size_t keySize, bool * inserted) {
+  HTNode * prevNode;
+  HTNode * node = NULL;
+  DSValue zero;
+
+  copy_boolean(inserted, false);
+
+  /* move a few buckets along if a rehash is in progress */
+  if(ht->oldTable != NULL) {
+    rehash_step(ht);
+  }
+
+  if(ht->oldTable != NULL) {
+    node = chain_find(ht, ht->oldTable[bucket_index(hash, ht->oldTableSize,
+						       ht->oldIndexMask)],
+		      hash, key, keySize, &prevNode);
+  }
+
+  if(node == NULL) {
+    node = chain_find(ht, ht->table[bucket_index(hash, ht->tableSize,
+						    ht->indexMask)],
+		      hash, key, keySize, &prevNode);
+  }
+
+  if(node == NULL) {
+    memset(&zero, 0, sizeof(DSValue));
+    node = node_new(ht, key, keySize, hash, &zero, NULL);
+    if(node == NULL) {
+      return NULL;
+    }
+
+    put_node(ht, node);
+    copy_boolean(inserted, true);
+
+    /* rehashing relinks the node, it never moves it */
+    check_load_factor(ht);
+  }
+
+  return node;
+}
+
+/**
+ * Gets a key's value in place given its hash, for whichever engine the
+ * table uses. Arguments are the same as ht_get_or_insert().
+ */
+static DSValue * get_or_insert_hashed(HT * ht, uint32_t hash, void * key,
+				      size_t keySize, bool * inserted) {
+  DSValue * value;
+  HTNode * node;
+  bool isNew = false;
+
+  if(HT_HAS_EXPIRIES(ht)) {
+    (void)ht_expire_if_due(ht, hash, key, keySize);
+  }
+
+  if(ht->ops != NULL) {
+    value = ht->ops->get_or_insert(ht, hash, key, keySize, &isNew);
+  } else if(ht->ebr != NULL) {
+    copy_boolean(inserted, false);
+    return NULL;
+  } else {
+    node = chained_get_or_insert(ht, hash, key, keySize, &isNew);
+    value = node != NULL ? &node->value : NULL;
+  }
+
+  if(value != NULL && isNew && HT_HAS_EXPIRIES(ht)) {
+    ht_expire_forget(ht, hash, key, keySize);
+  }
+
+  copy_boolean(inserted, value != NULL && isNew);
+  return value;
+}
+
+/**
+ * Gets a pointer to a key's stored value, inserting the key with a zeroed
+ * value if it is missing. Counters and aggregates can then be updated in
+ * place with one lookup:
+ *
+ *   DSValue * count = ht_get_or_insert(ht, word, len, NULL);
+ *   if(count != NULL) count->longVal++;
+ *
+ * With the chained engine the pointer stays valid until the key is removed
+ * or the table is freed. HT_ENGINE_SWISS moves values when it grows, and
+ * HT_ENGINE_CUCKOO whenever it inserts, so there the pointer is only valid
+ * until the next insert. Not available in
+ * lock-free read mode, where readers may be copying the value at any time;
+ * use ht_update() instead.
+ * ht: the hashtable instance.
+ * key: the key to look up or insert.
+ * keySize: the number of bytes from key to be used as the key.
+ * inserted: recv. true if the key was inserted by this call, or NULL.
+ * returns: a pointer to the key's value, or NULL on memory allocation error
+ * or in lock-free read mode.
+ */
+DSValue * ht_get_or_insert(HT * ht, void * key, size_t keySize,
+			   bool * inserted) {
+  return get_or_insert_hashed(ht, hash_key(ht, key, keySize), key, keySize,
+			      inserted);
+}
+
+/**
+ * Reads, modifies and writes back a key's value with one lookup. The
+ * callback gets the current value, or zeroes if the key is missing, and
+ * decides whether the key is kept. See HTUpdateFunc.
+ * ht: the hashtable instance.
+ * key: the key to update.
+ * keySize: the number of bytes from key to be used as the key.
+ * update: the callback.
+ * context: passed through to the callback.
+ * returns: true on success, or false on memory allocation error.
+ */
+bool ht_update(HT * ht, void * key, size_t keySize, HTUpdateFunc update,
+	       void * context) {
+  uint32_t hash = hash_key(ht, key, keySize);
+  DSValue * value;
+  DSValue copy;
+  bool inserted;
+
+  /* published nodes are never written in place, so update a copy and put
+   * it back as a new node
+   */
+  if(ht->ebr != NULL) {
+    bool exists = chained_get(ht, hash, key, keySize, &copy);
+
+    if(!exists) {
+      memset(&copy, 0, sizeof(DSValue));
+    }
+
+    if(update(&copy, exists, context)) {
+      return chained_put(ht, hash, key, keySize, &copy, NULL, NULL);
+    }
+    return !exists || chained_put(ht, hash, key, keySize, NULL, NULL, NULL);
+  }
+
+  value = get_or_insert_hashed(ht, hash, key, keySize, &inserted);
+  if(value == NULL) {
+    return false;
+  }
+
+  /* the callback declined, drop the key, even if it was just inserted */
+  if(!update(value, !inserted, context)) {
+    ht_put_hashed(ht, hash, key, keySize, NULL, NULL, NULL);
+  }
+
+  return true;
+}
+
+/**
+ * Prefetches the bucket heads of a group of hashes in both bucket arrays.
+ */
+static void prefetch_buckets(HT * ht, uint32_t * hashes, int n) {
+  int j;
+
+  for(j = 0; j < n; j++) {
+    HT_PREFETCH(&ht->table[bucket_index(hashes[j], ht->tableSize,
+					ht->indexMask)]);
+    if(ht->oldTable != NULL) {
+      HT_PREFETCH(&ht->oldTable[bucket_index(hashes[j], ht->oldTableSize,
+					     ht->oldIndexMask)]);
+    }
+  }
+}
+
+/**
+ * Prefetches the first node of each chain for a group of hashes. By the
+ * time this runs the bucket heads requested by prefetch_buckets() should
+ * have arrived, so reading them doesn't stall.
+ */
+static void prefetch_heads(HT * ht, uint32_t * hashes, int n) {
+  int j;
+
+  for(j = 0; j < n; j++) {
+    HT_PREFETCH(ht->table[bucket_index(hashes[j], ht->tableSize,
+				       ht->indexMask)]);
+    if(ht->oldTable != NULL) {
+      HT_PREFETCH(ht->oldTable[bucket_index(hashes[j], ht->oldTableSize,
+					    ht->oldIndexMask)]);
+    }
+  }
+}
+
+/**
+ * Gets many values at once. Keys are processed in groups: every key in a
+ * group is hashed and its bucket prefetched, then the first node of each
+ * chain is prefetched, and only then are the lookups resolved. The cache
+ * misses of a group overlap instead of being paid one key at a time.
+ * ht: the hashtable instance.
+ * keys: array of count pointers to keys.
+ * keySizes: array of count key lengths, in bytes.
+ * count: the number of keys to look up.
+ * values: array of count DSValues that recv. the value of each key that is
+ * found, or NULL.
+ * found: array of count booleans that recv. whether each key was found, or
+ * NULL.
+ * returns: the number of keys found.
+ */
+int ht_get_many(HT * ht, void ** keys, size_t * keySizes, int count,
+		DSValue * values, bool * found) {
+  uint32_t hashes[HT_BATCH_GROUP];
+  int numFound = 0;
+  int base;
+
+  for(base = 0; base < count; base += HT_BATCH_GROUP) {
+    int n = count - base < HT_BATCH_GROUP ? count - base : HT_BATCH_GROUP;
+    bool direct = ht->ops == NULL && ht->ebr == NULL && !HT_HAS_EXPIRIES(ht);
+    int j;
+
+    if(direct) {
+
+      /* do this group's share of any incremental rehash up front, so the
+       * buckets don't move between the prefetch and the lookup
+       */
+      for(j = 0; j < n && ht->oldTable != NULL; j++) {
+	rehash_step(ht);
+      }
+
+      for(j = 0; j < n; j++) {
+	hashes[j] = hash_key(ht, keys[base + j], keySizes[base + j]);
+      }
+      prefetch_buckets(ht, hashes, n);
+      prefetch_heads(ht, hashes, n);
+    }
+
+    for(j = 0; j < n; j++) {
+      DSValue * value = values != NULL ? &values[base + j] : NULL;
+      bool exists;
+
+      if(!direct) {
+
+	/* lock-free readers can't touch ht->table, which the writer may be
+	 * replacing, and keys with expiries must be checked first
+	 */
+	exists = ht_get_raw_key(ht, keys[base + j], keySizes[base + j],
+				value);
+      } else {
+	exists = find_in_tables(ht, hashes[j], keys[base + j],
+				keySizes[base + j], NULL, value, false);
+	count_lookup(ht, exists);
+      }
+
+      copy_boolean(found != NULL ? &found[base + j] : NULL, exists);
+      if(exists) {
+	numFound++;
+      }
+    }
+  }
+
+  return numFound;
+}
+
+/**
+ * Stores many values at once, prefetching the buckets of each group of
+ * keys before inserting them. Same as calling ht_put_raw_key() on each key
+ * in order.
+ * ht: the hashtable instance.
+ * keys: array of count pointers to keys.
+ * keySizes: array of count key lengths, in bytes.
+ * newValues: array of count values to store.
+ * count: the number of keys to store.
+ * returns: true on success, or false if a memory allocation error occurred,
+ * in which case keys before the failing one have been stored.
+ */
+bool ht_put_many(HT * ht, void ** keys, size_t * keySizes,
+		 DSValue * newValues, int count) {
+  uint32_t hashes[HT_BATCH_GROUP];
+  int base;
+
+  for(base = 0; base < count; base += HT_BATCH_GROUP) {
+    int n = count - base < HT_BATCH_GROUP ? count - base : HT_BATCH_GROUP;
+    int j;
+
+    if(ht->ops != NULL || HT_HAS_EXPIRIES(ht)) {
+      for(j = 0; j < n; j++) {
+	if(!ht_put_raw_key(ht, keys[base + j], keySizes[base + j],
+			   &newValues[base + j], NULL, NULL)) {
+	  return false;
+	}
+      }
+      continue;
+    }
+
+    for(j = 0; j < n; j++) {
+      hashes[j] = hash_key(ht, keys[base + j], keySizes[base + j]);
+    }
+    prefetch_buckets(ht, hashes, n);
+    prefetch_heads(ht, hashes, n);
+
+    for(j = 0; j < n; j++) {
+      if(!chained_put(ht, hashes[j], keys[base + j], keySizes[base + j],
+		      &newValues[base + j], NULL, NULL)) {
+	return false;
+      }
+    }
+  }
+
+  return true;
+}
+
 /**
  * Moves iterator control to the next bucket containing items.
  * i: a HTIter
@@ -621,8 +1920,10 @@ bool ht_get(HT * ht, char * key, DSValue * value) {
  */
 static bool iter_next_bucket(HTIter * i) {
 
-  /* if no more buckets, return false */
-  if(i->index == i->instance->tableSize) {
+  /* if no more buckets, return false. the table may have shrunk since
+   * the iterator got here
+   */
+  if(i->index >= i->instance->tableSize) {
     return false;
   }
 
@@ -662,6 +1963,16 @@ void ht_iter_get(HT * ht, HTIter * i) {
   /* store table in iterator */
   i->instance = ht;
 
+  if(ht->ops != NULL) {
+    ht->ops->iter_get(ht, i);
+    return;
+  }
+
+  /* iteration is O(table) anyway, so finish any incremental rehash rather
+   * than walking two bucket arrays
+   */
+  rehash_finish(ht);
+
   /* I really don't like this...but we're starting looking at bucket 0
    * but iter_next_bucket increments index each time its called...
    * make note of this quirk before you modify the code.
@@ -672,7 +1983,6 @@ void ht_iter_get(HT * ht, HTIter * i) {
   iter_next_bucket(i);
 }
 
-
 /**
  * Checks the iterator for items that have not been iterated over yet by
  * checking the current bucket for the next item. If no more items are left in
@@ -692,6 +2002,10 @@ void ht_iter_get(HT * ht, HTIter * i) {
 bool ht_iter_has_next(HTIter * i) {
   bool hasNext = false;
 
+  if(i->instance->ops != NULL) {
+    return i->instance->ops->iter_has_next(i);
+  }
+
   /* if there are items remaining in current bucket */
   if(i->index < i->instance->tableSize
      && i->currentNode != NULL) {
@@ -706,6 +2020,14 @@ bool ht_iter_has_next(HTIter * i) {
     }
   }
 
+  /* removals through the iterator only shrink the table once it is done,
+   * since shrinking moves nodes between buckets
+   */
+  if(!hasNext && i->removed) {
+    i->removed = false;
+    check_shrink(i->instance);
+  }
+
   return hasNext;
 }
 
@@ -715,22 +2037,70 @@ bool ht_iter_has_next(HTIter * i) {
  */
 static void iter_remove_node(HTIter * i, HTNode * currentNode) {
 
+  if(HT_HAS_EXPIRIES(i->instance)) {
+    ht_expire_forget(i->instance, currentNode->hash,
+		     HT_NODE_KEY(currentNode), currentNode->keySize);
+  }
+
   if(currentNode == i->instance->table[i->index]) {
 
     /* if this is the first node in the list,
      * set head to current head's next node
      */
-    i->instance->table[i->index] = currentNode->next;
-    node_free(currentNode);
+    unlink_node(i->instance, &i->instance->table[i->index], currentNode);
   } else {
 
     /* if not the first node, set the previous node's next to point to current
      * node's next
      */
-    i->prevNode->next = currentNode->next;
-    node_free(currentNode);
+    unlink_node(i->instance, &i->prevNode->next, currentNode);
+  }
+
+  i->removed = true;
+}
+
+/**
+ * Removes the next item of a non-chained table through the iterator,
+ * taking the key's expiry with it. Engines only copy keys out, so the key
+ * is first read through a copy of the iterator. Arguments are the same as
+ * ht_iter_next().
+ * returns: true if an item was removed, or false at the end of the table,
+ * or on memory allocation error, when nothing is removed.
+ */
+static bool iter_remove_expiring(HTIter * i, void * keyBuffer,
+				 size_t keyBufferLen, DSValue * value,
+				 size_t * keyLen) {
+  HT * ht = i->instance;
+  char shortKey[HT_POOL_KEY_SIZE];
+  void * key = shortKey;
+  HTIter peek = *i;
+  size_t peekLen;
+  bool removed;
+
+  if(!ht->ops->iter_next(&peek, shortKey, sizeof(shortKey), NULL, &peekLen,
+			 false)) {
+    return false;
+  }
+
+  if(peekLen > sizeof(shortKey)) {
+    key = malloc(peekLen);
+    if(key == NULL) {
+      return false;
+    }
+    peek = *i;
+    ht->ops->iter_next(&peek, key, peekLen, NULL, &peekLen, false);
+  }
+
+  removed = ht->ops->iter_next(i, keyBuffer, keyBufferLen, value, keyLen,
+			       true);
+  if(removed) {
+    ht_expire_forget(ht, hash_key(ht, key, peekLen), key, peekLen);
+  }
+
+  if(key != shortKey) {
+    free(key);
   }
-  i->instance->numItems--;
+  return removed;
 }
 
 /**
@@ -760,6 +2130,14 @@ bool ht_iter_next(HTIter * i, void * keyBuffer,
 			       size_t keyBufferLen, DSValue * value,
 			       size_t * keyLen, bool remove) {
 
+  if(i->instance->ops != NULL) {
+    if(remove && HT_HAS_EXPIRIES(i->instance)) {
+      return iter_remove_expiring(i, keyBuffer, keyBufferLen, value, keyLen);
+    }
+    return i->instance->ops->iter_next(i, keyBuffer, keyBufferLen,
+				       value, keyLen, remove);
+  }
+
   /* checks to see if a value exists
    * this call also advances the iterator to the next non-empty bucket
    * if neccessary. make note of this. it isn't magic.
@@ -774,13 +2152,15 @@ bool ht_iter_next(HTIter * i, void * keyBuffer,
     /* we've output the value, now advance to next node */
     i->currentNode = currentNode->next;
 
-    /* check if we need to remove node */
+    /* check if we need to remove node, otherwise it becomes the previous
+     * node for the next removal in this bucket
+     */
     if(remove) {
       iter_remove_node(i, currentNode);
+    } else {
+      i->prevNode = currentNode;
     }
 
-    i->prevNode = currentNode;
-
     return true;
   }
 
@@ -808,12 +2188,44 @@ int ht_size(HT * ht) {
 void ht_free(HT * ht) {
   HTIter i;
 
-  ht_iter_get(ht, &i);
+  if(ht->expires != NULL) {
+    ht_free(ht->expires);
+    ht->expires = NULL;
+  }
+
+  if(ht->ops != NULL) {
+    ht->ops->free(ht);
+    free(ht);
+    return;
+  }
+
+  /* no readers can remain, so nodes are freed directly instead of retired.
+   * the view's bucket array is ht->table
+   */
+  if(ht->ebr != NULL) {
+    free(ht->readView);
+    ht->ebr = NULL;
+  }
+
+  /* don't shrink a table that is about to be freed */
+  ht->shrinkFactor = 0;
+
+  /* pooled nodes all live in the pool's slabs, so the lists only need to
+   * be walked if some nodes were too large for the pool
+   */
+  if(ht->nodePool == NULL || ht->heapNodes > 0) {
+    ht_iter_get(ht, &i);
+
+    /* free linked lists */
+    while(ht_iter_next(&i, NULL, 0, NULL, NULL, true) != false);
+  }
 
-  /* free linked lists */
-  while(ht_iter_next(&i, NULL, 0, NULL, NULL, true) != false);
+  if(ht->nodePool != NULL) {
+    pool_free(ht->nodePool);
+  }
 
   /* free the array and struct */
+  free(ht->oldTable);
   free(ht->table);
   free(ht);
 }
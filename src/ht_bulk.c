@@ -0,0 +1,430 @@
+/**
+ * HashTable Bulk Construction
+ * (C) 2013 Christian Gunderman
+ *
+ * Builds a chained table from arrays in passes instead of one put at a
+ * time: the table is sized once for every key, the keys are hashed in a
+ * tight loop, then counting sorted by bucket. Nodes are then written in
+ * bucket order into one block from the node pool, so each chain is
+ * contiguous in memory and the block is filled front to back. There are
+ * no load factor checks or rehashes along the way, and duplicate checks
+ * only walk the chain being built.
+ *
+ * With DATASTRUCT_ENABLE_THREADS, each pass can be split across threads:
+ * hashing and counting by ranges of keys, with one bucket histogram per
+ * thread, and node writing by ranges of buckets. Nothing is shared between
+ * threads within a pass, so no locks are taken.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include "ht_internal.h"
+
+#ifdef DATASTRUCT_ENABLE_THREADS
+#include <pthread.h>
+#endif /* DATASTRUCT_ENABLE_THREADS */
+
+/* initial table size, before it is grown to fit the keys */
+#define BULK_MIN_TABLE_SIZE 16
+
+/* slab size of the node pool for nodes added after the build */
+#define BULK_NODES_PER_SLAB 256
+
+/* most threads a build uses */
+#ifdef DATASTRUCT_ENABLE_THREADS
+#define BULK_MAX_THREADS 64
+#else
+#define BULK_MAX_THREADS 1
+#endif /* DATASTRUCT_ENABLE_THREADS */
+
+/* fewest keys per thread worth starting a thread for */
+#define BULK_MIN_KEYS_PER_THREAD 4096
+
+/* Build state shared by every thread */
+typedef struct BulkBuild {
+  HT * ht;
+  void ** keys;
+  size_t * keySizes;
+  DSValue * values;      /* NULL for zeroed values */
+  uint32_t * hashes;     /* by input index */
+  int * sorted;          /* input indexes in bucket order */
+  int * bucketStarts;    /* tableSize + 1 offsets into sorted */
+  char * block;          /* one pool item per sorted position */
+  unsigned char * linked; /* whether each block item became a node */
+  size_t itemSize;
+} BulkBuild;
+
+/* One thread's share of a pass */
+typedef struct BulkJob {
+  BulkBuild * build;
+  int firstKey;          /* input indexes, for hashing and sorting */
+  int lastKey;
+  int firstBucket;       /* buckets, for writing nodes */
+  int lastBucket;
+  int * counts;          /* this job's bucket histogram, then positions */
+  int numItems;
+  int heapNodes;
+  bool failed;
+} BulkJob;
+
+/* A pass over one job */
+typedef void (*BulkPass)(BulkJob * job);
+
+/**
+ * Gets a key's bucket. Same as bucket_index() in ht.c.
+ */
+static int bulk_bucket(HT * ht, uint32_t hash) {
+  if(ht->indexMask != 0) {
+    return hash & ht->indexMask;
+  }
+  return hash % ht->tableSize;
+}
+
+/**
+ * Hashes a job's keys and counts them by bucket.
+ */
+static void pass_hash(BulkJob * job) {
+  BulkBuild * b = job->build;
+  int i;
+
+  for(i = job->firstKey; i < job->lastKey; i++) {
+    b->hashes[i] = HT_HASH(b->ht, b->keys[i], b->keySizes[i]);
+    job->counts[bulk_bucket(b->ht, b->hashes[i])]++;
+  }
+}
+
+/**
+ * Places a job's keys at their sorted positions. Keys keep their input
+ * order within a bucket, so later duplicates win as with ht_put_raw_key().
+ */
+static void pass_sort(BulkJob * job) {
+  BulkBuild * b = job->build;
+  int i;
+
+  for(i = job->firstKey; i < job->lastKey; i++) {
+    b->sorted[job->counts[bulk_bucket(b->ht, b->hashes[i])]++] = i;
+  }
+}
+
+/**
+ * Writes the nodes of a job's buckets. Short keys go in the block item of
+ * their sorted position, and longer ones in nodes of their own.
+ */
+static void pass_link(BulkJob * job) {
+  BulkBuild * b = job->build;
+  DSValue zero;
+  int bucket;
+
+  memset(&zero, 0, sizeof(DSValue));
+
+  for(bucket = job->firstBucket; bucket < job->lastBucket; bucket++) {
+    HTNode * head = NULL;
+    HTNode * tail = NULL;
+    int p;
+
+    for(p = b->bucketStarts[bucket]; p < b->bucketStarts[bucket + 1]; p++) {
+      int i = b->sorted[p];
+      DSValue * value = b->values != NULL ? &b->values[i] : &zero;
+      size_t keySize = b->keySizes[i];
+      HTNode * prevNode;
+      HTNode * node = ht_chain_find(head, b->hashes[i], b->keys[i], keySize,
+				    &prevNode);
+
+      if(node != NULL) {
+	node->value = *value;
+	continue;
+      }
+
+      if(keySize <= HT_POOL_KEY_SIZE) {
+	node = (HTNode*)(b->block + b->itemSize * p);
+	memcpy(HT_NODE_KEY(node), b->keys[i], keySize);
+	node->hash = b->hashes[i];
+	node->keySize = keySize;
+	node->value = *value;
+	b->linked[p] = 1;
+      } else {
+	node = ht_node_alloc(b->keys[i], keySize, b->hashes[i], value);
+	/* keep the partial chain linked, for ht_free() to release */
+	if(node == NULL) {
+	  b->ht->table[bucket] = head;
+	  job->failed = true;
+	  return;
+	}
+	job->heapNodes++;
+      }
+
+      /* append, keeping the chain in block order */
+      node->next = NULL;
+      if(tail != NULL) {
+	tail->next = node;
+      } else {
+	head = node;
+      }
+      tail = node;
+      job->numItems++;
+    }
+
+    b->ht->table[bucket] = head;
+  }
+}
+
+#ifdef DATASTRUCT_ENABLE_THREADS
+
+/* pass run by the threads of run_pass(), set before they start */
+typedef struct BulkThread {
+  BulkJob * job;
+  BulkPass pass;
+} BulkThread;
+
+/**
+ * Calls a thread's pass.
+ */
+static void * run_thread(void * arg) {
+  BulkThread * thread = (BulkThread*)arg;
+
+  thread->pass(thread->job);
+  return NULL;
+}
+
+/**
+ * Runs a pass over every job, the first on the calling thread and the
+ * rest on threads of their own. Jobs whose thread can't be started run on
+ * the calling thread too.
+ */
+static void run_pass(BulkJob * jobs, int numJobs, BulkPass pass) {
+  pthread_t threads[BULK_MAX_THREADS];
+  BulkThread args[BULK_MAX_THREADS];
+  bool started[BULK_MAX_THREADS];
+  int n;
+
+  for(n = 1; n < numJobs; n++) {
+    args[n].job = &jobs[n];
+    args[n].pass = pass;
+    started[n] = pthread_create(&threads[n], NULL, run_thread,
+				&args[n]) == 0;
+  }
+
+  pass(&jobs[0]);
+
+  for(n = 1; n < numJobs; n++) {
+    if(started[n]) {
+      pthread_join(threads[n], NULL);
+    } else {
+      pass(&jobs[n]);
+    }
+  }
+}
+
+#else
+
+/**
+ * Runs a pass over every job on the calling thread.
+ */
+static void run_pass(BulkJob * jobs, int numJobs, BulkPass pass) {
+  int n;
+
+  for(n = 0; n < numJobs; n++) {
+    pass(&jobs[n]);
+  }
+}
+
+#endif /* DATASTRUCT_ENABLE_THREADS */
+
+/**
+ * Frees a build's work arrays.
+ */
+static void build_free(BulkBuild * b, BulkJob * jobs, int numJobs) {
+  int n;
+
+  for(n = 0; n < numJobs; n++) {
+    free(jobs[n].counts);
+  }
+  free(b->hashes);
+  free(b->sorted);
+  free(b->bucketStarts);
+  free(b->linked);
+}
+
+/**
+ * Fills an empty chained table that has a node pool and enough buckets
+ * for count keys.
+ * returns: false on memory allocation error. The table must then be freed.
+ */
+static bool build_chained(HT * ht, void ** keys, size_t * keySizes,
+			  DSValue * values, int count, int numThreads) {
+  BulkBuild b;
+  BulkJob jobs[BULK_MAX_THREADS];
+  int numJobs = count / BULK_MIN_KEYS_PER_THREAD;
+  bool ok = true;
+  int bucket;
+  int pos = 0;
+  int n;
+  int p;
+
+  if(numJobs > numThreads) {
+    numJobs = numThreads;
+  }
+  if(numJobs > BULK_MAX_THREADS) {
+    numJobs = BULK_MAX_THREADS;
+  }
+  if(numJobs < 1) {
+    numJobs = 1;
+  }
+
+  memset(&b, 0, sizeof(BulkBuild));
+  memset(jobs, 0, sizeof(BulkJob) * numJobs);
+  b.ht = ht;
+  b.keys = keys;
+  b.keySizes = keySizes;
+  b.values = values;
+  b.itemSize = pool_item_size(ht->nodePool);
+  b.hashes = (uint32_t*)malloc(sizeof(uint32_t) * count);
+  b.sorted = (int*)malloc(sizeof(int) * count);
+  b.bucketStarts = (int*)malloc(sizeof(int) * (ht->tableSize + 1));
+  b.linked = (unsigned char*)calloc(count, 1);
+
+  for(n = 0; n < numJobs; n++) {
+    jobs[n].build = &b;
+    jobs[n].firstKey = (int)((size_t)count * n / numJobs);
+    jobs[n].lastKey = (int)((size_t)count * (n + 1) / numJobs);
+    jobs[n].firstBucket = (int)((size_t)ht->tableSize * n / numJobs);
+    jobs[n].lastBucket = (int)((size_t)ht->tableSize * (n + 1) / numJobs);
+    jobs[n].counts = (int*)calloc(ht->tableSize, sizeof(int));
+    ok = ok && jobs[n].counts != NULL;
+  }
+
+  if(!ok || b.hashes == NULL || b.sorted == NULL || b.bucketStarts == NULL
+     || b.linked == NULL
+     || (b.block = (char*)pool_alloc_block(ht->nodePool, count)) == NULL) {
+    build_free(&b, jobs, numJobs);
+    return false;
+  }
+
+  run_pass(jobs, numJobs, pass_hash);
+
+  /* turn the histograms into positions: bucket by bucket, and within a
+   * bucket job by job, so keys stay in input order
+   */
+  for(bucket = 0; bucket < ht->tableSize; bucket++) {
+    b.bucketStarts[bucket] = pos;
+    for(n = 0; n < numJobs; n++) {
+      int numKeys = jobs[n].counts[bucket];
+
+      jobs[n].counts[bucket] = pos;
+      pos += numKeys;
+    }
+  }
+  b.bucketStarts[ht->tableSize] = pos;
+
+  run_pass(jobs, numJobs, pass_sort);
+  run_pass(jobs, numJobs, pass_link);
+
+  for(n = 0; n < numJobs; n++) {
+    ht->numItems += jobs[n].numItems;
+    ht->heapNodes += jobs[n].heapNodes;
+    ok = ok && !jobs[n].failed;
+  }
+
+  /* items left over by long keys and duplicates serve later inserts */
+  for(p = 0; p < count; p++) {
+    if(!b.linked[p]) {
+      pool_release(ht->nodePool, b.block + b.itemSize * p);
+    }
+  }
+
+  build_free(&b, jobs, numJobs);
+  return ok;
+}
+
+/**
+ * Creates a table holding count keys and values from arrays, in one pass
+ * per step instead of count puts. The table is sized once, so it never
+ * rehashes while being built. Same as ht_new_ex() followed by
+ * ht_put_raw_key() on each key in order: if a key appears more than once,
+ * its last value is kept.
+ *
+ * HT_ENGINE_CHAINED tables, outside lock-free read mode, are built with
+ * their nodes in one block from the node pool, which such tables always
+ * get; options->nodesPerSlab only sets the slab size for later inserts.
+ * Other tables are presized and then filled with puts.
+ * keys: array of count pointers to keys.
+ * keySizes: array of count key lengths, in bytes.
+ * values: array of count values, or NULL to give every key a zeroed value.
+ * count: the number of keys.
+ * loadFactor: load upon which the table grows, as for ht_new().
+ * options: the creation options, or NULL for the defaults.
+ * numThreads: the most threads to build with, the calling thread
+ * included. Pass 1 to build on the calling thread only. Builds always run
+ * on the calling thread unless the library is built with
+ * DATASTRUCT_ENABLE_THREADS, which needs -lpthread.
+ * returns: a new table, or NULL on memory allocation error.
+ */
+HT * ht_from_arrays(void ** keys, size_t * keySizes, DSValue * values,
+		    int count, float loadFactor, HTOptions * options,
+		    int numThreads) {
+  HTOptions buildOptions;
+  bool bulk;
+  HT * ht;
+
+  if(options != NULL) {
+    buildOptions = *options;
+  } else {
+    ht_options_init(&buildOptions);
+  }
+
+  /* build without incremental rehashing, and with a node pool */
+  bulk = buildOptions.engine == HT_ENGINE_CHAINED && buildOptions.ebr == NULL;
+  if(bulk) {
+    buildOptions.rehashStep = 0;
+    if(buildOptions.nodesPerSlab <= 0) {
+      buildOptions.nodesPerSlab = BULK_NODES_PER_SLAB;
+    }
+  }
+
+  ht = ht_new_ex(BULK_MIN_TABLE_SIZE, BULK_MIN_TABLE_SIZE, loadFactor,
+		 &buildOptions);
+  if(ht == NULL) {
+    return NULL;
+  }
+
+  if(!ht_reserve(ht, count)) {
+    ht_free(ht);
+    return NULL;
+  }
+
+  if(bulk) {
+    if(count > 0 && !build_chained(ht, keys, keySizes, values, count,
+				   numThreads)) {
+      ht_free(ht);
+      return NULL;
+    }
+    ht->rehashStep = options != NULL ? options->rehashStep : 0;
+  } else {
+    DSValue zero;
+    int i;
+
+    memset(&zero, 0, sizeof(DSValue));
+    for(i = 0; i < count; i++) {
+      if(!ht_put_raw_key(ht, keys[i], keySizes[i],
+			 values != NULL ? &values[i] : &zero, NULL, NULL)) {
+	ht_free(ht);
+	return NULL;
+      }
+    }
+  }
+
+  return ht;
+}
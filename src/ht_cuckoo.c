@@ -0,0 +1,629 @@
+/**
+ * Bucketized Cuckoo HashTable Engine
+ * (C) 2013 Christian Gunderman
+ *
+ * Cuckoo hashing behind the HT interface. Every key has two candidate
+ * buckets of four slots each and is always in one of them, so a lookup
+ * reads at most two buckets however the keys are distributed; there are no
+ * chains or probe sequences to grow long. The first bucket comes from the
+ * table's hash and the second from the second output of lookup3's
+ * hashlittle2(). With the default hash_lookup3 the two are exactly the two
+ * outputs of one hashlittle2() call. The second hash is only computed when
+ * the first bucket doesn't hold the key, and inserts fill the first bucket
+ * while it has room, so most hits cost one hash and one bucket.
+ *
+ * When both buckets of a new key are full, a breadth first search finds
+ * the shortest chain of keys that can each move to their other bucket,
+ * ending in a bucket with a free slot, and the keys are moved along it from
+ * the far end. Both hashes are kept in the slots, so moving a key never
+ * reads or rehashes it. Four way buckets let the table fill to 95% before
+ * such searches fail, at which point it doubles.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include "ht_internal.h"
+#include "lookup3.h"
+
+#define CUCKOO_WAYS 4
+#define CUCKOO_MAX_LOAD 0.95f
+#define CUCKOO_MIN_BUCKETS 2
+
+/* most keys moved to make room for one insert */
+#define CUCKOO_MAX_PATH 5
+
+/* most buckets visited by one search for a free slot */
+#define CUCKOO_SEARCH_SIZE 512
+
+/* four key/value slots, with the hashes together so that a lookup scans
+ * them before touching any key
+ */
+typedef struct CuckooBucket {
+  uint32_t hashes[CUCKOO_WAYS];    /* table hash of each key */
+  uint32_t altHashes[CUCKOO_WAYS]; /* second hash, for moving keys */
+  void * keys[CUCKOO_WAYS];        /* NULL in empty slots */
+  size_t keySizes[CUCKOO_WAYS];
+  DSValue values[CUCKOO_WAYS];
+} CuckooBucket;
+
+/* engine storage, hung off of ht->engineData */
+typedef struct Cuckoo {
+  CuckooBucket * buckets;
+  size_t numBuckets;               /* a power of two */
+} Cuckoo;
+
+/* a bucket reached by the free slot search, and the move that leads
+ * there: the key in slot of the parent's bucket goes to this bucket
+ */
+typedef struct CuckooStep {
+  size_t bucket;
+  int slot;
+  int parent;                      /* -1 for the key's own buckets */
+  int depth;
+} CuckooStep;
+
+/**
+ * Gets the second hash of a key: the second output of hashlittle2(),
+ * whose first output is hash_lookup3() with the same seed.
+ */
+static uint32_t alt_hash(HT * ht, void * key, size_t keySize) {
+  uint32_t c = ht->hashSeed;
+  uint32_t b = 0;
+
+  hashlittle2(key, keySize, &c, &b);
+  return b;
+}
+
+/**
+ * Gets a key's first bucket.
+ */
+static size_t first_bucket(Cuckoo * c, uint32_t hash) {
+  return hash & (c->numBuckets - 1);
+}
+
+/**
+ * Gets a key's second bucket, which always differs from its first.
+ */
+static size_t second_bucket(Cuckoo * c, uint32_t hash, uint32_t altHash) {
+  size_t first = first_bucket(c, hash);
+  size_t second = altHash & (c->numBuckets - 1);
+
+  return second != first ? second : first ^ 1;
+}
+
+/**
+ * Gets the bucket the key in a slot would move to.
+ */
+static size_t other_bucket(Cuckoo * c, size_t bucket, int slot) {
+  CuckooBucket * b = &c->buckets[bucket];
+  size_t first = first_bucket(c, b->hashes[slot]);
+
+  if(first != bucket) {
+    return first;
+  }
+  return second_bucket(c, b->hashes[slot], b->altHashes[slot]);
+}
+
+/**
+ * Finds a key in one bucket.
+ * returns: the slot, or -1.
+ */
+static int bucket_find(CuckooBucket * b, uint32_t hash, void * key,
+		       size_t keySize) {
+  int n;
+
+  for(n = 0; n < CUCKOO_WAYS; n++) {
+    if(b->hashes[n] == hash && b->keys[n] != NULL
+       && b->keySizes[n] == keySize
+       && memcmp(b->keys[n], key, keySize) == 0) {
+      return n;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Finds an empty slot in one bucket.
+ * returns: the slot, or -1 if the bucket is full.
+ */
+static int bucket_free_slot(CuckooBucket * b) {
+  int n;
+
+  for(n = 0; n < CUCKOO_WAYS; n++) {
+    if(b->keys[n] == NULL) {
+      return n;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Finds the slot holding key, reading at most its two buckets.
+ * altHash: recv. the key's second hash when the key is not in its first
+ * bucket, and always when it is not found.
+ * bucket: recv. the bucket holding the key.
+ * returns: the slot, or -1 if the key is not in the table.
+ */
+static int find_slot(HT * ht, uint32_t hash, void * key, size_t keySize,
+		     uint32_t * altHash, size_t * bucket) {
+  Cuckoo * c = (Cuckoo*)ht->engineData;
+  int slot;
+
+  *bucket = first_bucket(c, hash);
+  slot = bucket_find(&c->buckets[*bucket], hash, key, keySize);
+  if(slot >= 0) {
+    return slot;
+  }
+
+  *altHash = alt_hash(ht, key, keySize);
+  *bucket = second_bucket(c, hash, *altHash);
+  return bucket_find(&c->buckets[*bucket], hash, key, keySize);
+}
+
+/**
+ * Checks whether a bucket is already on the path to a search step. Paths
+ * never pass through a bucket twice, so moving keys along one never
+ * overwrites a key that is still to be moved.
+ */
+static bool on_path(CuckooStep * steps, int n, size_t bucket) {
+  for(; n >= 0; n = steps[n].parent) {
+    if(steps[n].bucket == bucket) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Searches breadth first from a key's buckets for the nearest bucket with
+ * a free slot, along moves of at most CUCKOO_MAX_PATH keys.
+ * steps: recv. the search, CUCKOO_SEARCH_SIZE entries.
+ * returns: the step reaching a free slot, or -1 if there is none.
+ */
+static int search_path(Cuckoo * c, size_t first, size_t second,
+		       CuckooStep * steps) {
+  int head = 0;
+  int tail = 0;
+
+  steps[tail].bucket = first;
+  steps[tail].parent = -1;
+  steps[tail++].depth = 0;
+  steps[tail].bucket = second;
+  steps[tail].parent = -1;
+  steps[tail++].depth = 0;
+
+  for(; head < tail; head++) {
+    int slot;
+
+    if(bucket_free_slot(&c->buckets[steps[head].bucket]) >= 0) {
+      return head;
+    }
+    if(steps[head].depth == CUCKOO_MAX_PATH) {
+      continue;
+    }
+
+    for(slot = 0; slot < CUCKOO_WAYS && tail < CUCKOO_SEARCH_SIZE; slot++) {
+      size_t next = other_bucket(c, steps[head].bucket, slot);
+
+      if(!on_path(steps, head, next)) {
+	steps[tail].bucket = next;
+	steps[tail].slot = slot;
+	steps[tail].parent = head;
+	steps[tail++].depth = steps[head].depth + 1;
+      }
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Moves a slot's key, hashes and value to an empty slot.
+ */
+static void move_slot(CuckooBucket * to, int toSlot, CuckooBucket * from,
+		      int fromSlot) {
+  to->hashes[toSlot] = from->hashes[fromSlot];
+  to->altHashes[toSlot] = from->altHashes[fromSlot];
+  to->keys[toSlot] = from->keys[fromSlot];
+  to->keySizes[toSlot] = from->keySizes[fromSlot];
+  to->values[toSlot] = from->values[fromSlot];
+  from->keys[fromSlot] = NULL;
+}
+
+/**
+ * Stores a copied key in one of its buckets, moving other keys along a
+ * path from search_path() if both are full.
+ * returns: the key's value in the table, or NULL if no path was found.
+ * The table is then unchanged.
+ */
+static DSValue * place(Cuckoo * c, uint32_t hash, uint32_t altHash,
+		       void * key, size_t keySize, DSValue * value) {
+  CuckooStep steps[CUCKOO_SEARCH_SIZE];
+  CuckooBucket * b;
+  int n;
+  int slot;
+
+  /* most keys land in their first bucket, without a search */
+  b = &c->buckets[first_bucket(c, hash)];
+  slot = bucket_free_slot(b);
+  if(slot < 0) {
+    n = search_path(c, first_bucket(c, hash),
+		    second_bucket(c, hash, altHash), steps);
+    if(n < 0) {
+      return NULL;
+    }
+
+    /* move keys from the free slot's end of the path back to its start */
+    slot = bucket_free_slot(&c->buckets[steps[n].bucket]);
+    for(; steps[n].parent >= 0; n = steps[n].parent) {
+      move_slot(&c->buckets[steps[n].bucket], slot,
+		&c->buckets[steps[steps[n].parent].bucket], steps[n].slot);
+      slot = steps[n].slot;
+    }
+    b = &c->buckets[steps[n].bucket];
+  }
+
+  b->hashes[slot] = hash;
+  b->altHashes[slot] = altHash;
+  b->keys[slot] = key;
+  b->keySizes[slot] = keySize;
+  b->values[slot] = *value;
+  return &b->values[slot];
+}
+
+/**
+ * Gets the maximum load for this table. Four way buckets stop finding
+ * short paths to a free slot at about 95% full, so the HT's load factor is
+ * clamped to that.
+ */
+static float cuckoo_max_load(HT * ht) {
+  if(ht->loadFactor <= 0.0f || ht->loadFactor > CUCKOO_MAX_LOAD) {
+    return CUCKOO_MAX_LOAD;
+  }
+  return ht->loadFactor;
+}
+
+/**
+ * Gets the fewest buckets, at least minBuckets, that hold numItems items
+ * within the maximum load.
+ */
+static size_t fit_buckets(HT * ht, size_t minBuckets, int numItems) {
+  size_t numBuckets = minBuckets;
+
+  while(numBuckets * CUCKOO_WAYS * cuckoo_max_load(ht) < (float)numItems) {
+    numBuckets <<= 1;
+  }
+  return numBuckets;
+}
+
+/**
+ * Moves all items into a new array of numBuckets buckets, doubling it
+ * again in the unlikely case that some item can't be placed. Stored hashes
+ * are reused, so no keys are read.
+ * returns: false on memory allocation error; the table is left unchanged.
+ */
+static bool cuckoo_rehash(HT * ht, size_t numBuckets) {
+  clock_t start = HT_STAT_CLOCK();
+  Cuckoo * c = (Cuckoo*)ht->engineData;
+  Cuckoo next;
+  size_t bucket;
+  int slot;
+
+  for(;; numBuckets <<= 1) {
+    bool placed = true;
+
+    next.numBuckets = numBuckets;
+    next.buckets = (CuckooBucket*)calloc(numBuckets, sizeof(CuckooBucket));
+    if(next.buckets == NULL) {
+      return false;
+    }
+
+    for(bucket = 0; bucket < c->numBuckets && placed; bucket++) {
+      CuckooBucket * b = &c->buckets[bucket];
+
+      for(slot = 0; slot < CUCKOO_WAYS && placed; slot++) {
+	if(b->keys[slot] != NULL) {
+	  placed = place(&next, b->hashes[slot], b->altHashes[slot],
+			 b->keys[slot], b->keySizes[slot],
+			 &b->values[slot]) != NULL;
+	}
+      }
+    }
+
+    if(placed) {
+      break;
+    }
+    free(next.buckets);
+  }
+
+  free(c->buckets);
+  *c = next;
+  ht->tableSize = (int)(numBuckets * CUCKOO_WAYS);
+  HT_STAT_REHASHED(ht, start);
+  return true;
+}
+
+/**
+ * Empties a slot.
+ */
+static void cuckoo_erase(HT * ht, size_t bucket, int slot) {
+  Cuckoo * c = (Cuckoo*)ht->engineData;
+
+  free(c->buckets[bucket].keys[slot]);
+  c->buckets[bucket].keys[slot] = NULL;
+  ht->numItems--;
+}
+
+/**
+ * Allocates the engine storage.
+ * tableSize: requested number of slots, rounded up to a power of two
+ * number of buckets.
+ */
+static bool cuckoo_init(HT * ht, int tableSize) {
+  Cuckoo * c = (Cuckoo*)calloc(1, sizeof(Cuckoo));
+  size_t numBuckets = CUCKOO_MIN_BUCKETS;
+
+  if(c == NULL) {
+    return false;
+  }
+
+  while(numBuckets * CUCKOO_WAYS < (size_t)tableSize) {
+    numBuckets <<= 1;
+  }
+
+  c->buckets = (CuckooBucket*)calloc(numBuckets, sizeof(CuckooBucket));
+  if(c->buckets == NULL) {
+    free(c);
+    return false;
+  }
+
+  c->numBuckets = numBuckets;
+  ht->engineData = c;
+  ht->tableSize = (int)(numBuckets * CUCKOO_WAYS);
+  return true;
+}
+
+/**
+ * Inserts a key that is known not to be in the table, growing it first if
+ * it is at its maximum load or no path to a free slot can be found.
+ * returns: the new value, or NULL on memory allocation error.
+ */
+static DSValue * cuckoo_insert(HT * ht, uint32_t hash, uint32_t altHash,
+			       void * key, size_t keySize, DSValue * value) {
+  Cuckoo * c = (Cuckoo*)ht->engineData;
+  void * keyCopy;
+  DSValue * stored;
+
+  if(c->numBuckets * CUCKOO_WAYS * cuckoo_max_load(ht)
+     < (float)(ht->numItems + 1)
+     && !cuckoo_rehash(ht, c->numBuckets << 1)) {
+    return NULL;
+  }
+
+  keyCopy = malloc(keySize > 0 ? keySize : 1);
+  if(keyCopy == NULL) {
+    return NULL;
+  }
+  memcpy(keyCopy, key, keySize);
+
+  while((stored = place(c, hash, altHash, keyCopy, keySize, value)) == NULL) {
+    if(!cuckoo_rehash(ht, c->numBuckets << 1)) {
+      free(keyCopy);
+      return NULL;
+    }
+  }
+
+  ht->numItems++;
+  return stored;
+}
+
+/**
+ * Stores, replaces, or removes (newValue == NULL) a value. Same contract as
+ * ht_put_hashed.
+ */
+static bool cuckoo_put(HT * ht, uint32_t hash, void * key, size_t keySize,
+		       DSValue * newValue, DSValue * oldValue,
+		       bool * prevValue) {
+  Cuckoo * c = (Cuckoo*)ht->engineData;
+  uint32_t altHash = 0;
+  size_t bucket;
+  int slot = find_slot(ht, hash, key, keySize, &altHash, &bucket);
+
+  if(prevValue != NULL) {
+    *prevValue = (slot >= 0);
+  }
+
+  if(slot >= 0) {
+    if(oldValue != NULL) {
+      memcpy(oldValue, &c->buckets[bucket].values[slot], sizeof(DSValue));
+    }
+
+    if(newValue != NULL) {
+      memcpy(&c->buckets[bucket].values[slot], newValue, sizeof(DSValue));
+    } else {
+      cuckoo_erase(ht, bucket, slot);
+    }
+    return true;
+  }
+
+  if(newValue == NULL) {
+    return true;
+  }
+
+  return cuckoo_insert(ht, hash, altHash, key, keySize, newValue) != NULL;
+}
+
+/**
+ * Finds a key's value in place, inserting it with a zeroed value if it is
+ * missing. Same contract as ht_get_or_insert, except that the pointer is
+ * only valid until the next insert.
+ */
+static DSValue * cuckoo_get_or_insert(HT * ht, uint32_t hash, void * key,
+				      size_t keySize, bool * inserted) {
+  Cuckoo * c = (Cuckoo*)ht->engineData;
+  uint32_t altHash = 0;
+  size_t bucket;
+  int slot = find_slot(ht, hash, key, keySize, &altHash, &bucket);
+  DSValue zero;
+  DSValue * value;
+
+  if(inserted != NULL) {
+    *inserted = false;
+  }
+
+  if(slot >= 0) {
+    return &c->buckets[bucket].values[slot];
+  }
+
+  memset(&zero, 0, sizeof(DSValue));
+  value = cuckoo_insert(ht, hash, altHash, key, keySize, &zero);
+  if(value != NULL && inserted != NULL) {
+    *inserted = true;
+  }
+  return value;
+}
+
+/**
+ * Looks up a value. Same contract as ht_get_hashed.
+ */
+static bool cuckoo_get(HT * ht, uint32_t hash, void * key, size_t keySize,
+		       DSValue * value) {
+  Cuckoo * c = (Cuckoo*)ht->engineData;
+  uint32_t altHash;
+  size_t bucket;
+  int slot = find_slot(ht, hash, key, keySize, &altHash, &bucket);
+
+  if(slot < 0) {
+    return false;
+  }
+
+  if(value != NULL) {
+    memcpy(value, &c->buckets[bucket].values[slot], sizeof(DSValue));
+  }
+  return true;
+}
+
+/**
+ * Grows the table so numItems items fit without rehashing.
+ */
+static bool cuckoo_reserve(HT * ht, int numItems) {
+  Cuckoo * c = (Cuckoo*)ht->engineData;
+  size_t numBuckets = fit_buckets(ht, c->numBuckets, numItems);
+
+  if(numBuckets == c->numBuckets) {
+    return true;
+  }
+  return cuckoo_rehash(ht, numBuckets);
+}
+
+/**
+ * Rehashes into the fewest buckets that hold the items.
+ */
+static bool cuckoo_compact(HT * ht) {
+  return cuckoo_rehash(ht, fit_buckets(ht, CUCKOO_MIN_BUCKETS,
+				       ht->numItems));
+}
+
+/**
+ * Positions an iterator at slot 0.
+ */
+static void cuckoo_iter_get(HT * ht, HTIter * i) {
+  i->index = 0;
+}
+
+/**
+ * Advances the iterator to the next full slot, if any.
+ */
+static bool cuckoo_iter_has_next(HTIter * i) {
+  Cuckoo * c = (Cuckoo*)i->instance->engineData;
+
+  while(i->index < i->instance->tableSize
+	&& c->buckets[i->index / CUCKOO_WAYS]
+	.keys[i->index % CUCKOO_WAYS] == NULL) {
+    i->index++;
+  }
+  return i->index < i->instance->tableSize;
+}
+
+/**
+ * Copies out the next item and optionally removes it. Removal never moves
+ * other slots, so iteration stays valid.
+ */
+static bool cuckoo_iter_next(HTIter * i, void * keyBuffer,
+			     size_t keyBufferLen, DSValue * value,
+			     size_t * keyLen, bool remove) {
+  Cuckoo * c = (Cuckoo*)i->instance->engineData;
+  CuckooBucket * b;
+  int slot;
+
+  if(!cuckoo_iter_has_next(i)) {
+    return false;
+  }
+
+  b = &c->buckets[i->index / CUCKOO_WAYS];
+  slot = i->index % CUCKOO_WAYS;
+
+  if(keyBuffer != NULL) {
+    memcpy(keyBuffer, b->keys[slot],
+	   keyBufferLen < b->keySizes[slot] ? keyBufferLen : b->keySizes[slot]);
+
+    if(keyLen != NULL) {
+      *keyLen = b->keySizes[slot];
+    }
+  }
+
+  if(value != NULL) {
+    memcpy(value, &b->values[slot], sizeof(DSValue));
+  }
+
+  if(remove) {
+    cuckoo_erase(i->instance, (size_t)(i->index / CUCKOO_WAYS), slot);
+  }
+
+  i->index++;
+  return true;
+}
+
+/**
+ * Frees every key and the engine storage.
+ */
+static void cuckoo_free(HT * ht) {
+  Cuckoo * c = (Cuckoo*)ht->engineData;
+  size_t bucket;
+  int slot;
+
+  for(bucket = 0; bucket < c->numBuckets; bucket++) {
+    for(slot = 0; slot < CUCKOO_WAYS; slot++) {
+      free(c->buckets[bucket].keys[slot]);
+    }
+  }
+
+  free(c->buckets);
+  free(c);
+}
+
+const HTEngineOps ht_cuckoo_ops = {
+  cuckoo_init,
+  cuckoo_put,
+  cuckoo_get,
+  cuckoo_get_or_insert,
+  cuckoo_reserve,
+  cuckoo_compact,
+  cuckoo_iter_get,
+  cuckoo_iter_has_next,
+  cuckoo_iter_next,
+  cuckoo_free
+};
@@ -0,0 +1,209 @@
+/**
+ * HashTable Key Expiry
+ * (C) 2013 Christian Gunderman
+ *
+ * Expiry times live in a second chained table, ht->expires, keyed by the
+ * same keys with the same hash function and seed, so a key's hash from the
+ * main table finds its expiry too. Tables with no expiring keys pay one
+ * pointer test per call. A key is removed when a get or put finds it due
+ * (lazy expiry), or when ht_expire_step() comes across it. The step walks
+ * the expires buckets from a cursor that persists between calls, so each
+ * call does a bounded amount of work and, over successive calls, visits
+ * every expiring key without ever scanning the main table.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include <time.h>
+#include "ht_internal.h"
+
+#ifdef DATASTRUCT_ENABLE_LONG
+
+/* initial size of the expires table */
+#define EXPIRES_TABLE_SIZE 16
+
+/**
+ * Checks whether keys in a table can be given expiry times. Lock-free
+ * readers can't remove keys, and read-only engines can't remove them
+ * either.
+ */
+static bool can_expire(HT * ht) {
+  return ht->ebr == NULL && ht->engine != HT_ENGINE_MAPPED
+    && ht->engine != HT_ENGINE_FROZEN;
+}
+
+/**
+ * Creates the expires table, hashing like the main table.
+ * returns: false on memory allocation error.
+ */
+static bool expires_new(HT * ht) {
+  HTOptions options;
+
+  ht_options_init(&options);
+  options.hashFunc = ht->hashFunc;
+  options.hashSeed = ht->hashSeed;
+
+  ht->expires = ht_new_ex(EXPIRES_TABLE_SIZE, EXPIRES_TABLE_SIZE,
+			  ht->loadFactor, &options);
+  return ht->expires != NULL;
+}
+
+/**
+ * Removes a key from the table and then its expiry. key may point into the
+ * expires node itself, so the node is freed last.
+ */
+static void expire_key(HT * ht, uint32_t hash, void * key, size_t keySize) {
+  HT * expires = ht->expires;
+
+  /* detach the expires table so the removal doesn't look there again */
+  ht->expires = NULL;
+  ht_put_hashed(ht, hash, key, keySize, NULL, NULL, NULL);
+  ht->expires = expires;
+
+  ht_put_hashed(expires, hash, key, keySize, NULL, NULL, NULL);
+}
+
+/**
+ * Removes a key if its expiry time has passed.
+ * returns: true if the key was removed.
+ */
+bool ht_expire_if_due(HT * ht, uint32_t hash, void * key, size_t keySize) {
+  DSValue when;
+
+  if(!ht_get_hashed(ht->expires, hash, key, keySize, &when)
+     || when.longVal > (long)time(NULL)) {
+    return false;
+  }
+
+  expire_key(ht, hash, key, keySize);
+  return true;
+}
+
+/**
+ * Drops a key's expiry time, if it has one.
+ */
+void ht_expire_forget(HT * ht, uint32_t hash, void * key, size_t keySize) {
+  ht_put_hashed(ht->expires, hash, key, keySize, NULL, NULL, NULL);
+}
+
+/**
+ * Sets the time at which a key is removed. The expiry stays with the key
+ * when its value is replaced, and goes when the key is removed or expires,
+ * so a key that is put again after that has none. Until a key is removed,
+ * iterators and ht_size() still count it. Files from ht_save() don't keep
+ * expiry times.
+ * ht: the hashtable instance. Not supported in lock-free read mode.
+ * key: the key, which must be in the table.
+ * keySize: the number of bytes from key to be used as the key.
+ * when: the expiry time in seconds, as from time(), or 0 to clear it.
+ * returns: false if the key isn't in the table, the table can't expire
+ * keys, or on memory allocation error.
+ */
+bool ht_set_expiry(HT * ht, void * key, size_t keySize, long when) {
+  uint32_t hash = ht_hash(ht, key, keySize);
+  DSValue value;
+
+  if(!can_expire(ht) || !ht_get_hashed(ht, hash, key, keySize, NULL)) {
+    return false;
+  }
+
+  if(when == 0) {
+    if(ht->expires != NULL) {
+      ht_expire_forget(ht, hash, key, keySize);
+    }
+    return true;
+  }
+
+  if(ht->expires == NULL && !expires_new(ht)) {
+    return false;
+  }
+
+  value.longVal = when;
+  return ht_put_hashed(ht->expires, hash, key, keySize, &value, NULL, NULL);
+}
+
+/**
+ * Gets a key's expiry time. A key found to be due is removed.
+ * ht: the hashtable instance.
+ * key: the key.
+ * keySize: the number of bytes from key to be used as the key.
+ * returns: the expiry time, or 0 if the key has none or isn't in the table.
+ */
+long ht_get_expiry(HT * ht, void * key, size_t keySize) {
+  uint32_t hash;
+  DSValue when;
+
+  if(!HT_HAS_EXPIRIES(ht)) {
+    return 0;
+  }
+
+  hash = ht_hash(ht, key, keySize);
+  if(ht_expire_if_due(ht, hash, key, keySize)
+     || !ht_get_hashed(ht->expires, hash, key, keySize, &when)) {
+    return 0;
+  }
+  return when.longVal;
+}
+
+/**
+ * Removes due keys without scanning the table, for keys that are never
+ * looked up again. Call it periodically, eg. from a timer. Each call
+ * checks up to maxChecks buckets and keys with expiry times, resuming
+ * where the last call stopped. If most keys checked were due, more are
+ * likely waiting, and calling again right away is worthwhile.
+ * ht: the hashtable instance.
+ * maxChecks: the most buckets and keys to check, which bounds the time the
+ * call takes. 20 to 100 suits most tables.
+ * returns: the number of keys removed.
+ */
+int ht_expire_step(HT * ht, int maxChecks) {
+  long now = (long)time(NULL);
+  int numExpired = 0;
+  int checks = 0;
+
+  while(checks < maxChecks && HT_HAS_EXPIRIES(ht)) {
+    HT * expires = ht->expires;
+    HTNode * node;
+
+    /* the expires table may have been resized since the last call */
+    if(ht->expireCursor >= expires->tableSize) {
+      ht->expireCursor = 0;
+    }
+
+    /* removing a key may resize the expires table, so rescan the bucket
+     * from its head after every removal
+     */
+    node = expires->table[ht->expireCursor];
+    checks++;
+
+    while(node != NULL && node->value.longVal > now) {
+      node = node->next;
+      checks++;
+    }
+
+    if(node == NULL) {
+      ht->expireCursor++;
+      continue;
+    }
+
+    expire_key(ht, node->hash, HT_NODE_KEY(node), node->keySize);
+    numExpired++;
+  }
+
+  return numExpired;
+}
+
+#endif /* DATASTRUCT_ENABLE_LONG */
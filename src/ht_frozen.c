@@ -0,0 +1,585 @@
+/**
+ * Frozen HashTable Engine
+ * (C) 2013 Christian Gunderman
+ *
+ * ht_freeze() turns a populated table into an immutable one indexed by a
+ * perfect hash, built PTHash style: each key's 64-bit hashlittle2() hash
+ * picks one of n / FROZEN_BUCKET_KEYS buckets, and each bucket stores a 16
+ * bit pilot. A key's slot is a mix of its hash and its bucket's pilot, and
+ * the build searches, largest buckets first, for the pilot that sends all
+ * of a bucket's keys to free slots. The slot array is about 1% larger than
+ * the number of keys, so a lookup is a pilot read (the pilot array is
+ * small and stays cached), then one slot read with no chains or probing.
+ * The pilots cost 16 / FROZEN_BUCKET_KEYS, about 3.2, bits per key.
+ *
+ * Keys are copied into one contiguous arena, and each slot holds its key's
+ * offset, length and table hash, so the arena is only touched on a hit.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include "ht_internal.h"
+#include "lookup3.h"
+
+/* average keys per bucket, and keys per slot */
+#define FROZEN_BUCKET_KEYS 5
+#define FROZEN_LOAD 0.99
+
+/* the share of keys, out of 2^32, and of buckets that are dense */
+#define FROZEN_DENSE_KEYS 0x9999999AUL
+#define FROZEN_DENSE_BUCKETS 0.3
+
+/* pilots are 16 bits, and a failed build retries with other seeds. A
+ * bucket this big is hopeless, and also makes the build retry
+ */
+#define FROZEN_MAX_PILOT 0xFFFF
+#define FROZEN_MAX_BUCKET 255
+#define FROZEN_MAX_ATTEMPTS 16
+
+/* keyOffset of a slot that holds no key */
+#define FROZEN_EMPTY ((size_t)-1)
+
+/* slots claimed during the build are tracked in a bitmap */
+#define TAKEN_GET(taken, n) ((taken)[(n) >> 3] & (1 << ((n) & 7)))
+#define TAKEN_FLIP(taken, n) ((taken)[(n) >> 3] ^= (1 << ((n) & 7)))
+
+/* builds a 64-bit constant from two halves, C89 has no 64-bit literals */
+#define U64(hi, lo) (((uint64_t)(hi) << 32) | (uint64_t)(lo))
+
+/* a key/value slot */
+typedef struct FrozenSlot {
+  size_t keyOffset;        /* into the arena, or FROZEN_EMPTY */
+  uint32_t hash;           /* the table's hash, checked before the key */
+  uint32_t keySize;
+  DSValue value;
+} FrozenSlot;
+
+/* engine storage, hung off of ht->engineData */
+typedef struct Frozen {
+  unsigned char * arena;
+  FrozenSlot * slots;
+  uint16_t * pilots;
+  uint32_t numSlots;
+  uint32_t numBuckets;
+  uint32_t numDense;
+  uint32_t seed1;
+  uint32_t seed2;
+} Frozen;
+
+/* a key collected from the table being frozen */
+typedef struct FrozenKey {
+  uint64_t hash;           /* the key's hashlittle2() hash */
+  size_t keyOffset;
+  uint32_t keySize;
+  DSValue value;
+} FrozenKey;
+
+/**
+ * Gets a key's 64-bit hash.
+ */
+static uint64_t key_hash(Frozen * f, const void * key, size_t keySize) {
+  uint32_t pc = f->seed1;
+  uint32_t pb = f->seed2;
+
+  hashlittle2(key, keySize, &pc, &pb);
+  return ((uint64_t)pc << 32) | pb;
+}
+
+/**
+ * Maps a 32-bit value onto [0, range) without a division.
+ */
+static uint32_t fast_range(uint32_t x, uint32_t range) {
+  return (uint32_t)(((uint64_t)x * range) >> 32);
+}
+
+/**
+ * Gets the bucket of a key's hash. As in PTHash, the upper half of the
+ * hash sends 60% of keys to the first 30% of buckets. Those dense buckets
+ * are placed first, while most slots are still free, leaving the sparse
+ * buckets, which are mostly one or two keys, for the end of the build.
+ */
+static uint32_t bucket_of(Frozen * f, uint64_t hash) {
+  if((uint32_t)(hash >> 32) < FROZEN_DENSE_KEYS) {
+    return fast_range((uint32_t)hash, f->numDense);
+  }
+  return f->numDense + fast_range((uint32_t)hash,
+				  f->numBuckets - f->numDense);
+}
+
+/**
+ * Gets the slot of a key's hash under a pilot. The pilot is spread over
+ * all 64 bits and mixed with the hash, so each pilot gives the bucket's
+ * keys an unrelated set of slots.
+ */
+static uint32_t slot_of(Frozen * f, uint64_t hash, uint32_t pilot) {
+  uint64_t x = hash ^ ((uint64_t)pilot * U64(0x9e3779b9, 0x7f4a7c15));
+
+  x ^= x >> 32;
+  x *= U64(0xd6e8feb8, 0x6659fd93);
+  x ^= x >> 32;
+  return fast_range((uint32_t)(x >> 32), f->numSlots);
+}
+
+/**
+ * Copies every key of the table into one arena, and collects the values.
+ * returns: the collected keys, or NULL on memory allocation error. Their
+ * hashes are not yet filled in.
+ */
+static FrozenKey * collect_keys(HT * ht, Frozen * f) {
+  FrozenKey * keys = (FrozenKey*)malloc(sizeof(FrozenKey)
+					* (ht->numItems + 1));
+  size_t arenaSize = 0;
+  size_t keySize;
+  char keyByte;
+  HTIter i;
+  int k = 0;
+
+  if(keys == NULL) {
+    return NULL;
+  }
+
+  /* measure first, so the arena is allocated once */
+  ht_iter_get(ht, &i);
+  while(ht_iter_next(&i, &keyByte, 0, NULL, &keySize, false)) {
+    if(keySize > 0xFFFFFFFFUL) {
+      free(keys);
+      return NULL;
+    }
+    keys[k].keyOffset = arenaSize;
+    keys[k].keySize = (uint32_t)keySize;
+    arenaSize += keySize;
+    k++;
+  }
+
+  f->arena = (unsigned char*)malloc(arenaSize > 0 ? arenaSize : 1);
+  if(f->arena == NULL) {
+    free(keys);
+    return NULL;
+  }
+
+  /* iteration visits the keys in the same order the second time */
+  ht_iter_get(ht, &i);
+  for(k = 0; k < ht->numItems; k++) {
+    ht_iter_next(&i, f->arena + keys[k].keyOffset, keys[k].keySize,
+		 &keys[k].value, NULL, false);
+  }
+
+  return keys;
+}
+
+/**
+ * Searches for a pilot for every bucket under the current seeds, biggest
+ * buckets first. order lists the keys grouped by bucket, with bucket b's
+ * keys at order[starts[b]] up to order[starts[b + 1]].
+ * returns: false if some bucket has no pilot that places all of its keys.
+ */
+static bool find_pilots(Frozen * f, FrozenKey * keys, uint32_t * order,
+			uint32_t * starts, unsigned char * taken,
+			uint32_t * positions) {
+  uint32_t * bySize;
+  uint32_t sizeCounts[FROZEN_MAX_BUCKET + 1];
+  uint32_t maxSize = 0;
+  uint32_t b;
+  uint32_t n;
+  bool ok = true;
+
+  /* order the buckets by descending size, with a counting sort */
+  bySize = (uint32_t*)malloc(sizeof(uint32_t) * f->numBuckets);
+  if(bySize == NULL) {
+    return false;
+  }
+
+  memset(sizeCounts, 0, sizeof(sizeCounts));
+  for(b = 0; b < f->numBuckets; b++) {
+    uint32_t size = starts[b + 1] - starts[b];
+
+    if(size > FROZEN_MAX_BUCKET) {
+      free(bySize);
+      return false;
+    }
+    sizeCounts[size]++;
+    if(size > maxSize) {
+      maxSize = size;
+    }
+  }
+
+  for(n = 0, b = maxSize + 1; b-- > 0;) {
+    uint32_t count = sizeCounts[b];
+
+    sizeCounts[b] = n;
+    n += count;
+  }
+
+  for(b = 0; b < f->numBuckets; b++) {
+    bySize[sizeCounts[starts[b + 1] - starts[b]]++] = b;
+  }
+
+  for(n = 0; n < f->numBuckets && ok; n++) {
+    uint32_t bucket = bySize[n];
+    uint32_t * members = order + starts[bucket];
+    uint32_t size = starts[bucket + 1] - starts[bucket];
+    uint32_t pilot;
+
+    if(size == 0) {
+      break;
+    }
+
+    for(pilot = 0; pilot <= FROZEN_MAX_PILOT; pilot++) {
+      uint32_t j;
+
+      /* every key must land on a free slot, and on different slots */
+      for(j = 0; j < size; j++) {
+	positions[j] = slot_of(f, keys[members[j]].hash, pilot);
+	if(TAKEN_GET(taken, positions[j])) {
+	  break;
+	}
+	TAKEN_FLIP(taken, positions[j]);
+      }
+
+      if(j == size) {
+	break;
+      }
+
+      while(j-- > 0) {
+	TAKEN_FLIP(taken, positions[j]);
+      }
+    }
+
+    if(pilot > FROZEN_MAX_PILOT) {
+      ok = false;
+    } else {
+      f->pilots[bucket] = (uint16_t)pilot;
+    }
+  }
+
+  free(bySize);
+  return ok;
+}
+
+/**
+ * Builds the pilots under the current seeds.
+ * returns: false on memory allocation error, or if no pilots were found.
+ */
+static bool build_pilots(Frozen * f, FrozenKey * keys, uint32_t numKeys) {
+  uint32_t * starts = (uint32_t*)calloc(f->numBuckets + 1, sizeof(uint32_t));
+  uint32_t * order = (uint32_t*)malloc(sizeof(uint32_t) * (numKeys + 1));
+  unsigned char * taken = (unsigned char*)calloc(f->numSlots / 8 + 1, 1);
+  uint32_t * positions = (uint32_t*)malloc(sizeof(uint32_t)
+					   * FROZEN_MAX_BUCKET);
+  uint32_t b;
+  uint32_t k;
+  bool ok = false;
+
+  if(starts != NULL && order != NULL && taken != NULL && positions != NULL) {
+
+    /* group the keys by bucket */
+    for(k = 0; k < numKeys; k++) {
+      starts[bucket_of(f, keys[k].hash) + 1]++;
+    }
+    for(b = 0; b < f->numBuckets; b++) {
+      starts[b + 1] += starts[b];
+    }
+    for(k = 0; k < numKeys; k++) {
+      order[starts[bucket_of(f, keys[k].hash)]++] = k;
+    }
+    for(b = f->numBuckets; b > 0; b--) {
+      starts[b] = starts[b - 1];
+    }
+    starts[0] = 0;
+
+    ok = find_pilots(f, keys, order, starts, taken, positions);
+  }
+
+  free(starts);
+  free(order);
+  free(taken);
+  free(positions);
+  return ok;
+}
+
+/**
+ * Fills the slots with the collected keys, now that the pilots are set.
+ */
+static void fill_slots(HT * ht, Frozen * f, FrozenKey * keys,
+		       uint32_t numKeys) {
+  uint32_t n;
+  uint32_t k;
+
+  for(n = 0; n < f->numSlots; n++) {
+    f->slots[n].keyOffset = FROZEN_EMPTY;
+  }
+
+  for(k = 0; k < numKeys; k++) {
+    uint64_t hash = keys[k].hash;
+    FrozenSlot * slot = &f->slots[slot_of(f, hash,
+					  f->pilots[bucket_of(f, hash)])];
+
+    slot->keyOffset = keys[k].keyOffset;
+    slot->keySize = keys[k].keySize;
+    slot->hash = HT_HASH(ht, f->arena + keys[k].keyOffset, keys[k].keySize);
+    memcpy(&slot->value, &keys[k].value, sizeof(DSValue));
+  }
+}
+
+/**
+ * Frees a frozen engine's storage.
+ */
+static void frozen_release(Frozen * f) {
+  free(f->arena);
+  free(f->slots);
+  free(f->pilots);
+  free(f);
+}
+
+/**
+ * Builds a frozen copy of the table's contents.
+ * returns: the engine storage, or NULL on memory allocation error, or if
+ * no perfect hash could be found (which takes distinct keys with equal 64
+ * bit hashes under every seed tried).
+ */
+static Frozen * frozen_build(HT * ht) {
+  Frozen * f = (Frozen*)calloc(1, sizeof(Frozen));
+  uint32_t numKeys = (uint32_t)ht->numItems;
+  FrozenKey * keys;
+  uint32_t attempt;
+  uint32_t k;
+  bool ok = false;
+
+  if(f == NULL) {
+    return NULL;
+  }
+
+  f->numBuckets = numKeys / FROZEN_BUCKET_KEYS + 2;
+  f->numDense = (uint32_t)(f->numBuckets * FROZEN_DENSE_BUCKETS) + 1;
+  f->numSlots = (uint32_t)(numKeys / FROZEN_LOAD) + 1;
+  f->slots = (FrozenSlot*)malloc(sizeof(FrozenSlot) * f->numSlots);
+  f->pilots = (uint16_t*)calloc(f->numBuckets, sizeof(uint16_t));
+  keys = f->slots != NULL && f->pilots != NULL ? collect_keys(ht, f) : NULL;
+
+  for(attempt = 0; keys != NULL && !ok && attempt < FROZEN_MAX_ATTEMPTS;
+      attempt++) {
+    f->seed1 = ht->hashSeed + attempt * 0x9e3779b9UL;
+    f->seed2 = ~f->seed1;
+
+    for(k = 0; k < numKeys; k++) {
+      keys[k].hash = key_hash(f, f->arena + keys[k].keyOffset,
+			      keys[k].keySize);
+    }
+    ok = build_pilots(f, keys, numKeys);
+  }
+
+  if(ok) {
+    fill_slots(ht, f, keys, numKeys);
+  }
+
+  free(keys);
+  if(!ok) {
+    frozen_release(f);
+    return NULL;
+  }
+  return f;
+}
+
+/**
+ * Converts a table, in place, to an immutable one indexed by a perfect
+ * hash. Lookups then hash the key once more with hashlittle2(), read one
+ * pilot and one slot, and compare the key only if the stored hash matches.
+ * The table's previous storage is freed.
+ *
+ * ht_get_raw_key(), ht_get(), ht_get_hashed(), ht_get_many(), iteration
+ * and ht_save() work as usual. Every call that would modify the table
+ * fails, returning false (or NULL), and removing through an iterator is
+ * ignored. Building takes a few passes over the keys, so freeze a table
+ * once it is fully loaded. Tables in lock-free read mode, or with keys
+ * that have expiry times, can't be frozen.
+ * ht: the hashtable instance.
+ * returns: false on memory allocation error, in which case the table is
+ * unchanged.
+ */
+bool ht_freeze(HT * ht) {
+  Frozen * f;
+  HT * old;
+
+  if(ht->engine == HT_ENGINE_FROZEN) {
+    return true;
+  }
+
+  if(ht->ebr != NULL || HT_HAS_EXPIRIES(ht)) {
+    return false;
+  }
+
+  f = frozen_build(ht);
+  old = (HT*)malloc(sizeof(HT));
+  if(f == NULL || old == NULL) {
+    if(f != NULL) {
+      frozen_release(f);
+    }
+    free(old);
+    return false;
+  }
+
+  /* hand the old storage to a copy of the struct, and free it with that */
+  memcpy(old, ht, sizeof(HT));
+  ht_free(old);
+
+  ht->table = NULL;
+  ht->expires = NULL;
+  ht->tableSize = (int)f->numSlots;
+  ht->indexMask = 0;
+  ht->shrinkFactor = 0;
+  ht->rehashStep = 0;
+  ht->oldTable = NULL;
+  ht->nodePool = NULL;
+  ht->heapNodes = 0;
+  ht->engine = HT_ENGINE_FROZEN;
+  ht->ops = &ht_frozen_ops;
+  ht->engineData = f;
+
+  return true;
+}
+
+/**
+ * Frozen tables can only be created by ht_freeze().
+ */
+static bool frozen_init(HT * ht, int tableSize) {
+  return false;
+}
+
+/**
+ * Rejects modifications.
+ */
+static bool frozen_put(HT * ht, uint32_t hash, void * key, size_t keySize,
+		       DSValue * newValue, DSValue * oldValue,
+		       bool * prevValue) {
+  return false;
+}
+
+/**
+ * Looks the key up in the one slot it can be in.
+ */
+static bool frozen_get(HT * ht, uint32_t hash, void * key, size_t keySize,
+		       DSValue * value) {
+  Frozen * f = (Frozen*)ht->engineData;
+  uint64_t keyHash = key_hash(f, key, keySize);
+  FrozenSlot * slot = &f->slots[slot_of(f, keyHash,
+					f->pilots[bucket_of(f, keyHash)])];
+
+  /* empty slots only have keyOffset set */
+  if(slot->keyOffset == FROZEN_EMPTY
+     || slot->hash != hash || slot->keySize != keySize
+     || memcmp(f->arena + slot->keyOffset, key, keySize) != 0) {
+    return false;
+  }
+
+  if(value != NULL) {
+    memcpy(value, &slot->value, sizeof(DSValue));
+  }
+  return true;
+}
+
+/**
+ * Rejects modifications.
+ */
+static DSValue * frozen_get_or_insert(HT * ht, uint32_t hash, void * key,
+				      size_t keySize, bool * inserted) {
+  return NULL;
+}
+
+/**
+ * Rejects modifications.
+ */
+static bool frozen_reserve(HT * ht, int numItems) {
+  return false;
+}
+
+/**
+ * Already as compact as it gets.
+ */
+static bool frozen_compact(HT * ht) {
+  return true;
+}
+
+/**
+ * Positions an iterator at slot 0.
+ */
+static void frozen_iter_get(HT * ht, HTIter * i) {
+  i->index = 0;
+}
+
+/**
+ * Advances the iterator to the next full slot, if any.
+ */
+static bool frozen_iter_has_next(HTIter * i) {
+  Frozen * f = (Frozen*)i->instance->engineData;
+
+  while(i->index < i->instance->tableSize
+	&& f->slots[i->index].keyOffset == FROZEN_EMPTY) {
+    i->index++;
+  }
+  return i->index < i->instance->tableSize;
+}
+
+/**
+ * Copies out the next item. remove is ignored.
+ */
+static bool frozen_iter_next(HTIter * i, void * keyBuffer,
+			     size_t keyBufferLen, DSValue * value,
+			     size_t * keyLen, bool remove) {
+  Frozen * f = (Frozen*)i->instance->engineData;
+  FrozenSlot * slot;
+
+  if(!frozen_iter_has_next(i)) {
+    return false;
+  }
+
+  slot = &f->slots[i->index];
+
+  if(keyBuffer != NULL) {
+    memcpy(keyBuffer, f->arena + slot->keyOffset,
+	   keyBufferLen < slot->keySize ? keyBufferLen : slot->keySize);
+
+    if(keyLen != NULL) {
+      *keyLen = slot->keySize;
+    }
+  }
+
+  if(value != NULL) {
+    memcpy(value, &slot->value, sizeof(DSValue));
+  }
+
+  i->index++;
+  return true;
+}
+
+/**
+ * Frees the engine storage.
+ */
+static void frozen_free(HT * ht) {
+  frozen_release((Frozen*)ht->engineData);
+}
+
+const HTEngineOps ht_frozen_ops = {
+  frozen_init,
+  frozen_put,
+  frozen_get,
+  frozen_get_or_insert,
+  frozen_reserve,
+  frozen_compact,
+  frozen_iter_get,
+  frozen_iter_has_next,
+  frozen_iter_next,
+  frozen_free
+};
@@ -0,0 +1,563 @@
+/**
+ * Memory Mapped HashTable Snapshots
+ * (C) 2013 Christian Gunderman
+ *
+ * ht_save() writes a table to a file as a position independent image, and
+ * ht_open_mmap() maps such a file and serves lookups straight out of the
+ * mapping, so opening a table of any size costs one mmap and pages are
+ * read in lazily as lookups touch them.
+ *
+ * File layout, all integers in the byte order of the machine that wrote it:
+ *
+ *   header   HTMapHeader: magic, version, hash function and seed, and the
+ *            offsets of the sections below
+ *   keys     every key's bytes, packed back to back
+ *   buckets  numBuckets + 1 uint32 entry indexes. Bucket b's entries are
+ *            entries[buckets[b]] up to, not including, entries[buckets[b+1]]
+ *   entries  numItems HTMapEntry records, grouped by bucket, each holding
+ *            the key's hash, length and file offset, and its value
+ *
+ * Values are stored as raw DSValue bytes, so pointer values are meaningless
+ * once loaded into another process.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+/* mmap and fstat are not visible in strict C89 mode without this */
+#define _XOPEN_SOURCE 600
+
+#include "ht_internal.h"
+
+#ifdef DATASTRUCT_ENABLE_MMAP
+
+#include <stdio.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HT_MAP_MAGIC "HTMP"
+#define HT_MAP_VERSION 1
+#define HT_MAP_BYTE_ORDER 0x01020304
+
+/* hash functions that can be recorded in a file, by id */
+#define HT_MAP_HASH_LOOKUP3 1
+#define HT_MAP_HASH_WY 2
+#define HT_MAP_HASH_CRC32C 3
+
+/* file header */
+typedef struct HTMapHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byteOrder;      /* HT_MAP_BYTE_ORDER as written */
+  uint32_t valueSize;      /* sizeof(DSValue) in the writer's build */
+  uint32_t hashId;
+  uint32_t hashSeed;
+  uint32_t numBuckets;     /* a power of two */
+  uint32_t reserved;
+  uint64_t numItems;
+  uint64_t keysOffset;
+  uint64_t bucketsOffset;
+  uint64_t entriesOffset;
+  uint64_t fileSize;
+} HTMapHeader;
+
+/* one key/value pair */
+typedef struct HTMapEntry {
+  uint64_t keyOffset;      /* from the start of the file */
+  uint32_t hash;
+  uint32_t keySize;
+  DSValue value;
+} HTMapEntry;
+
+/* engine storage, hung off of ht->engineData */
+typedef struct HTMapped {
+  void * base;
+  size_t length;
+  const uint32_t * buckets;
+  const HTMapEntry * entries;
+  uint32_t mask;
+} HTMapped;
+
+/**
+ * Gets the id recorded for a hash function.
+ * returns: the id, or 0 if the function can't be recorded.
+ */
+static uint32_t hash_id(HashFunc hashFunc) {
+  if(hashFunc == hash_lookup3) {
+    return HT_MAP_HASH_LOOKUP3;
+  } else if(hashFunc == hash_wy) {
+    return HT_MAP_HASH_WY;
+  } else if(hashFunc == hash_crc32c) {
+    return HT_MAP_HASH_CRC32C;
+  }
+  return 0;
+}
+
+/**
+ * Gets the hash function for a recorded id.
+ * returns: the function, or NULL if the id is unknown.
+ */
+static HashFunc hash_from_id(uint32_t id) {
+  switch(id) {
+  case HT_MAP_HASH_LOOKUP3:
+    return hash_lookup3;
+  case HT_MAP_HASH_WY:
+    return hash_wy;
+  case HT_MAP_HASH_CRC32C:
+    return hash_crc32c;
+  default:
+    return NULL;
+  }
+}
+
+/**
+ * Rounds a file offset up to a multiple of 8.
+ */
+static uint64_t align8(uint64_t offset) {
+  return (offset + 7) & ~(uint64_t)7;
+}
+
+/**
+ * Writes zero bytes to pad the file from offset to align8(offset).
+ * returns: false on a write error.
+ */
+static bool write_padding(FILE * file, uint64_t offset) {
+  static const char zeroes[8] = { 0 };
+  size_t padding = (size_t)(align8(offset) - offset);
+
+  return fwrite(zeroes, 1, padding, file) == padding;
+}
+
+/**
+ * Writes the key blob, and collects each item's hash and the number of
+ * items in each bucket. Items are visited in iteration order, so hashes[k]
+ * belongs to the k-th item.
+ * returns: false on memory allocation or write error.
+ */
+static bool write_keys(HT * ht, FILE * file, size_t maxKeySize,
+		       uint32_t mask, uint32_t * hashes, uint32_t * counts) {
+  void * key = malloc(maxKeySize > 0 ? maxKeySize : 1);
+  HTIter i;
+  size_t keySize;
+  int k = 0;
+
+  if(key == NULL) {
+    return false;
+  }
+
+  ht_iter_get(ht, &i);
+  while(ht_iter_next(&i, key, maxKeySize, NULL, &keySize, false)) {
+    if(fwrite(key, 1, keySize, file) != keySize) {
+      free(key);
+      return false;
+    }
+
+    hashes[k] = ht_hash(ht, key, keySize);
+    counts[hashes[k] & mask]++;
+    k++;
+  }
+
+  free(key);
+  return true;
+}
+
+/**
+ * Writes the bucket index and the entries, grouped by bucket. counts holds
+ * the number of items in each bucket, and is overwritten.
+ * returns: false on memory allocation or write error.
+ */
+static bool write_entries(HT * ht, FILE * file, uint32_t numBuckets,
+			  uint64_t keysOffset, uint32_t * hashes,
+			  uint32_t * counts) {
+  HTMapEntry * entries = NULL;
+  uint64_t keyOffset = keysOffset;
+  uint32_t start = 0;
+  uint32_t b;
+  HTIter i;
+  DSValue value;
+  size_t keySize;
+  char keyByte;
+  int k = 0;
+  bool ok;
+
+  if(ht->numItems > 0) {
+    entries = (HTMapEntry*)calloc(ht->numItems, sizeof(HTMapEntry));
+    if(entries == NULL) {
+      return false;
+    }
+  }
+
+  /* turn the counts into each bucket's first entry */
+  for(b = 0; b < numBuckets; b++) {
+    uint32_t count = counts[b];
+
+    counts[b] = start;
+    start += count;
+  }
+
+  ok = fwrite(counts, sizeof(uint32_t), numBuckets, file) == numBuckets
+    && fwrite(&start, sizeof(uint32_t), 1, file) == 1
+    && write_padding(file, (uint64_t)(numBuckets + 1) * sizeof(uint32_t));
+
+  /* the keys were written in this same order, back to back */
+  ht_iter_get(ht, &i);
+  while(ok && ht_iter_next(&i, &keyByte, 0, &value, &keySize, false)) {
+    HTMapEntry * entry = &entries[counts[hashes[k] & (numBuckets - 1)]++];
+
+    entry->keyOffset = keyOffset;
+    entry->hash = hashes[k];
+    entry->keySize = (uint32_t)keySize;
+    memcpy(&entry->value, &value, sizeof(DSValue));
+
+    keyOffset += keySize;
+    k++;
+  }
+
+  if(ok && ht->numItems > 0) {
+    ok = fwrite(entries, sizeof(HTMapEntry), ht->numItems, file)
+      == (size_t)ht->numItems;
+  }
+
+  free(entries);
+  return ok;
+}
+
+/**
+ * Writes the table to a file that ht_open_mmap() can map. Works for tables
+ * of any engine. The table must not be modified while it is being saved.
+ * Write to a temporary file and rename() it into place if readers may open
+ * the path at the same time.
+ * ht: the hashtable instance.
+ * path: the file to create or overwrite.
+ * returns: false on a write or memory allocation error, or if the table
+ * uses a hash function other than hash_lookup3, hash_wy or hash_crc32c, or
+ * holds a key longer than 4GB.
+ */
+bool ht_save(HT * ht, const char * path) {
+  HTMapHeader header;
+  uint32_t * hashes = NULL;
+  uint32_t * counts = NULL;
+  size_t maxKeySize = 0;
+  uint64_t keyBytes = 0;
+  uint32_t numBuckets = 16;
+  FILE * file;
+  HTIter i;
+  size_t keySize;
+  char keyByte;
+  bool ok;
+
+  if(hash_id(ht->hashFunc) == 0) {
+    return false;
+  }
+
+  /* measure the keys, to lay out the file before writing any of it */
+  ht_iter_get(ht, &i);
+  while(ht_iter_next(&i, &keyByte, 0, NULL, &keySize, false)) {
+    if(keySize > 0xFFFFFFFFUL) {
+      return false;
+    }
+    if(keySize > maxKeySize) {
+      maxKeySize = keySize;
+    }
+    keyBytes += keySize;
+  }
+
+  /* about one entry per bucket */
+  while(numBuckets < (uint32_t)ht->numItems) {
+    numBuckets <<= 1;
+  }
+
+  memset(&header, 0, sizeof(HTMapHeader));
+  memcpy(header.magic, HT_MAP_MAGIC, sizeof(header.magic));
+  header.version = HT_MAP_VERSION;
+  header.byteOrder = HT_MAP_BYTE_ORDER;
+  header.valueSize = sizeof(DSValue);
+  header.hashId = hash_id(ht->hashFunc);
+  header.hashSeed = ht->hashSeed;
+  header.numBuckets = numBuckets;
+  header.numItems = (uint64_t)ht->numItems;
+  header.keysOffset = sizeof(HTMapHeader);
+  header.bucketsOffset = align8(header.keysOffset + keyBytes);
+  header.entriesOffset = align8(header.bucketsOffset
+				+ (uint64_t)(numBuckets + 1) * sizeof(uint32_t));
+  header.fileSize = header.entriesOffset
+    + header.numItems * sizeof(HTMapEntry);
+
+  hashes = (uint32_t*)malloc(sizeof(uint32_t) * (ht->numItems + 1));
+  counts = (uint32_t*)calloc(numBuckets, sizeof(uint32_t));
+  file = fopen(path, "wb");
+
+  ok = hashes != NULL && counts != NULL && file != NULL
+    && fwrite(&header, sizeof(HTMapHeader), 1, file) == 1
+    && write_keys(ht, file, maxKeySize, numBuckets - 1, hashes, counts)
+    && write_padding(file, header.keysOffset + keyBytes)
+    && write_entries(ht, file, numBuckets, header.keysOffset, hashes, counts);
+
+  if(file != NULL && fclose(file) != 0) {
+    ok = false;
+  }
+
+  free(hashes);
+  free(counts);
+  return ok;
+}
+
+/**
+ * Checks that a mapped file is an image this build can read, and that
+ * every section lies inside it. Entries are trusted, and not checked one
+ * by one, which would page in the whole file.
+ */
+static bool header_valid(const HTMapHeader * header, size_t length) {
+  const uint32_t * buckets;
+
+  if(length < sizeof(HTMapHeader)
+     || memcmp(header->magic, HT_MAP_MAGIC, sizeof(header->magic)) != 0
+     || header->version != HT_MAP_VERSION
+     || header->byteOrder != HT_MAP_BYTE_ORDER
+     || header->valueSize != sizeof(DSValue)
+     || hash_from_id(header->hashId) == NULL
+     || header->fileSize != (uint64_t)length
+     || header->numItems > INT_MAX) {
+    return false;
+  }
+
+  /* a power of two, and small enough not to overflow the checks below */
+  if(header->numBuckets == 0 || header->numBuckets > 0x40000000UL
+     || (header->numBuckets & (header->numBuckets - 1)) != 0) {
+    return false;
+  }
+
+  if(header->keysOffset < sizeof(HTMapHeader)
+     || header->bucketsOffset < header->keysOffset
+     || header->bucketsOffset % 8 != 0
+     || header->entriesOffset % 8 != 0
+     || header->entriesOffset < header->bucketsOffset
+     + (uint64_t)(header->numBuckets + 1) * sizeof(uint32_t)
+     || header->entriesOffset > header->fileSize
+     || (header->fileSize - header->entriesOffset) / sizeof(HTMapEntry)
+     < header->numItems) {
+    return false;
+  }
+
+  buckets = (const uint32_t*)((const char*)header + header->bucketsOffset);
+  return buckets[header->numBuckets] == header->numItems;
+}
+
+/**
+ * Opens a file written by ht_save() as a read-only table. The file is
+ * mapped, not read: lookups page in the parts of it they touch. It must
+ * have been written by a build with the same byte order and DSValue size.
+ *
+ * ht_get_raw_key(), ht_get(), ht_get_hashed(), ht_get_many() and iteration
+ * work as usual. Every call that would modify the table fails, returning
+ * false (or NULL), and removing through an iterator is ignored. The file
+ * should not be modified while it is open. ht_free() unmaps it.
+ * path: the file to open.
+ * returns: a new HT using HT_ENGINE_MAPPED, or NULL if the file can't be
+ * opened or mapped, or isn't a valid image.
+ */
+HT * ht_open_mmap(const char * path) {
+  const HTMapHeader * header;
+  HTMapped * mapped;
+  struct stat st;
+  void * base;
+  HT * ht;
+  int fd = open(path, O_RDONLY);
+
+  if(fd < 0) {
+    return NULL;
+  }
+
+  if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(HTMapHeader)) {
+    close(fd);
+    return NULL;
+  }
+
+  base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED) {
+    return NULL;
+  }
+
+  header = (const HTMapHeader*)base;
+  ht = (HT*)calloc(1, sizeof(HT));
+  mapped = (HTMapped*)calloc(1, sizeof(HTMapped));
+
+  if(!header_valid(header, (size_t)st.st_size)
+     || ht == NULL || mapped == NULL) {
+    munmap(base, (size_t)st.st_size);
+    free(ht);
+    free(mapped);
+    return NULL;
+  }
+
+  mapped->base = base;
+  mapped->length = (size_t)st.st_size;
+  mapped->buckets = (const uint32_t*)((const char*)base
+				      + header->bucketsOffset);
+  mapped->entries = (const HTMapEntry*)((const char*)base
+					+ header->entriesOffset);
+  mapped->mask = header->numBuckets - 1;
+
+  ht->tableSize = (int)header->numBuckets;
+  ht->loadFactor = 1.0f;
+  ht->numItems = (int)header->numItems;
+  ht->indexMask = mapped->mask;
+  ht->hashFunc = hash_from_id(header->hashId);
+  ht->hashSeed = header->hashSeed;
+  ht->engine = HT_ENGINE_MAPPED;
+  ht->ops = &ht_mapped_ops;
+  ht->engineData = mapped;
+
+  return ht;
+}
+
+/**
+ * Mapped tables can only be created by ht_open_mmap().
+ */
+static bool mapped_init(HT * ht, int tableSize) {
+  return false;
+}
+
+/**
+ * Rejects modifications.
+ */
+static bool mapped_put(HT * ht, uint32_t hash, void * key, size_t keySize,
+		       DSValue * newValue, DSValue * oldValue,
+		       bool * prevValue) {
+  return false;
+}
+
+/**
+ * Scans the key's bucket, comparing hashes before keys.
+ */
+static bool mapped_get(HT * ht, uint32_t hash, void * key, size_t keySize,
+		       DSValue * value) {
+  HTMapped * mapped = (HTMapped*)ht->engineData;
+  uint32_t b = hash & mapped->mask;
+  uint32_t end = mapped->buckets[b + 1];
+  uint32_t n;
+
+  for(n = mapped->buckets[b]; n < end; n++) {
+    const HTMapEntry * entry = &mapped->entries[n];
+
+    if(entry->hash == hash && entry->keySize == keySize
+       && memcmp((const char*)mapped->base + entry->keyOffset, key,
+		 keySize) == 0) {
+      if(value != NULL) {
+	memcpy(value, &entry->value, sizeof(DSValue));
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Rejects modifications.
+ */
+static DSValue * mapped_get_or_insert(HT * ht, uint32_t hash, void * key,
+				      size_t keySize, bool * inserted) {
+  return NULL;
+}
+
+/**
+ * Rejects modifications.
+ */
+static bool mapped_reserve(HT * ht, int numItems) {
+  return false;
+}
+
+/**
+ * The image is already as compact as it gets.
+ */
+static bool mapped_compact(HT * ht) {
+  return true;
+}
+
+/**
+ * Positions an iterator at the first entry.
+ */
+static void mapped_iter_get(HT * ht, HTIter * i) {
+  i->index = 0;
+}
+
+/**
+ * Checks for entries left.
+ */
+static bool mapped_iter_has_next(HTIter * i) {
+  return i->index < i->instance->numItems;
+}
+
+/**
+ * Copies out the next entry, in file order. remove is ignored.
+ */
+static bool mapped_iter_next(HTIter * i, void * keyBuffer,
+			     size_t keyBufferLen, DSValue * value,
+			     size_t * keyLen, bool remove) {
+  HTMapped * mapped = (HTMapped*)i->instance->engineData;
+  const HTMapEntry * entry;
+
+  if(!mapped_iter_has_next(i)) {
+    return false;
+  }
+
+  entry = &mapped->entries[i->index];
+
+  if(keyBuffer != NULL) {
+    memcpy(keyBuffer, (const char*)mapped->base + entry->keyOffset,
+	   keyBufferLen < entry->keySize ? keyBufferLen : entry->keySize);
+
+    if(keyLen != NULL) {
+      *keyLen = entry->keySize;
+    }
+  }
+
+  if(value != NULL) {
+    memcpy(value, &entry->value, sizeof(DSValue));
+  }
+
+  i->index++;
+  return true;
+}
+
+/**
+ * Unmaps the file.
+ */
+static void mapped_free(HT * ht) {
+  HTMapped * mapped = (HTMapped*)ht->engineData;
+
+  munmap(mapped->base, mapped->length);
+  free(mapped);
+}
+
+const HTEngineOps ht_mapped_ops = {
+  mapped_init,
+  mapped_put,
+  mapped_get,
+  mapped_get_or_insert,
+  mapped_reserve,
+  mapped_compact,
+  mapped_iter_get,
+  mapped_iter_has_next,
+  mapped_iter_next,
+  mapped_free
+};
+
+#endif /* DATASTRUCT_ENABLE_MMAP */
@@ -0,0 +1,498 @@
+/**
+ * Insertion Ordered HashTable Engine
+ * (C) 2013 Christian Gunderman
+ *
+ * Compact dict storage behind the HT interface, laid out like CPython's
+ * dict. Items are appended to a dense array of entries, and their keys to
+ * a byte arena, in insertion order. The hash index is an open addressed
+ * array of int32 entry numbers, with a slot holding EMPTY, DUMMY (a removed
+ * entry, which probes must pass over) or the number of an entry.
+ *
+ * There are no per item allocations and no next pointers, and the index
+ * costs a few bytes per item. Iteration is a linear scan of the entries,
+ * in the order the keys were first inserted. Replacing a value keeps the
+ * key's place; removing it and inserting it again moves it to the end.
+ * Removed entries and their key bytes stay in place until the entry array
+ * fills up, when the live ones are packed down and the index is rebuilt.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include "ht_internal.h"
+
+#define ORDERED_MIN_SIZE 8
+#define ORDERED_MAX_LOAD (2.0f / 3.0f)
+#define ORDERED_MIN_ARENA 64
+
+/* index slot states, other values are entry numbers */
+#define IX_EMPTY (-1)
+#define IX_DUMMY (-2)
+
+/* keyOffset of a removed entry */
+#define ENTRY_DELETED ((size_t)-1)
+
+/* an item, in insertion order */
+typedef struct OrderedEntry {
+  size_t keyOffset;        /* into the arena, or ENTRY_DELETED */
+  uint32_t hash;
+  uint32_t keySize;
+  DSValue value;
+} OrderedEntry;
+
+/* engine storage, hung off of ht->engineData */
+typedef struct Ordered {
+  int32_t * index;
+  uint32_t indexMask;
+  OrderedEntry * entries;
+  int numEntries;          /* entries used, including removed ones */
+  int capacity;            /* entries allocated */
+  unsigned char * arena;
+  size_t arenaUsed;
+  size_t arenaSize;
+} Ordered;
+
+/**
+ * Gets the maximum load for this table. The index is only 4 bytes a slot,
+ * so it is kept sparse to keep probes short.
+ */
+static float ordered_max_load(HT * ht) {
+  if(ht->loadFactor <= 0.0f || ht->loadFactor > ORDERED_MAX_LOAD) {
+    return ORDERED_MAX_LOAD;
+  }
+  return ht->loadFactor;
+}
+
+/**
+ * Gets the index size needed to hold numItems items.
+ */
+static uint32_t fit_index(HT * ht, int numItems) {
+  uint32_t size = ORDERED_MIN_SIZE;
+
+  while((float)size * ordered_max_load(ht) < (float)numItems + 1) {
+    size <<= 1;
+  }
+  return size;
+}
+
+/**
+ * Steps along a hash's probe sequence, as CPython does. The perturbation
+ * mixes in the high bits of the hash, and once it runs out the sequence
+ * (i * 5 + 1) mod size visits every slot.
+ */
+static uint32_t next_probe(uint32_t i, uint32_t * perturb, uint32_t mask) {
+  *perturb >>= 5;
+  return (i * 5 + *perturb + 1) & mask;
+}
+
+/**
+ * Finds the index slot that points at a key's entry.
+ * returns: the index slot, or -1 if the key isn't in the table.
+ */
+static long find_index(Ordered * o, uint32_t hash, void * key,
+		       size_t keySize) {
+  uint32_t perturb = hash;
+  uint32_t i = hash & o->indexMask;
+
+  for(;;) {
+    int32_t ix = o->index[i];
+
+    if(ix == IX_EMPTY) {
+      return -1;
+    }
+
+    if(ix >= 0) {
+      OrderedEntry * entry = &o->entries[ix];
+
+      if(entry->hash == hash && entry->keySize == keySize
+	 && memcmp(o->arena + entry->keyOffset, key, keySize) == 0) {
+	return (long)i;
+      }
+    }
+
+    i = next_probe(i, &perturb, o->indexMask);
+  }
+}
+
+/**
+ * Finds the first EMPTY or DUMMY index slot on a hash's probe sequence.
+ * Entries are never more than the index's load, so this terminates.
+ */
+static uint32_t find_free_index(Ordered * o, uint32_t hash) {
+  uint32_t perturb = hash;
+  uint32_t i = hash & o->indexMask;
+
+  while(o->index[i] >= 0) {
+    i = next_probe(i, &perturb, o->indexMask);
+  }
+  return i;
+}
+
+/**
+ * Packs the live entries and their keys into new arrays sized for an index
+ * of indexSize slots, and rebuilds the index. Order is preserved.
+ * returns: false on memory allocation error; the table is left unchanged.
+ */
+static bool ordered_resize(HT * ht, uint32_t indexSize) {
+  clock_t start = HT_STAT_CLOCK();
+  Ordered * o = (Ordered*)ht->engineData;
+  bool initial = o->entries == NULL;
+  int capacity = (int)(indexSize * ordered_max_load(ht));
+  int32_t * index = (int32_t*)malloc(sizeof(int32_t) * indexSize);
+  OrderedEntry * entries;
+  unsigned char * arena;
+  size_t arenaSize = ORDERED_MIN_ARENA;
+  size_t liveBytes = 0;
+  int numEntries = 0;
+  int n;
+
+  for(n = 0; n < o->numEntries; n++) {
+    if(o->entries[n].keyOffset != ENTRY_DELETED) {
+      liveBytes += o->entries[n].keySize;
+    }
+  }
+
+  /* leave room for keys to grow with the entries */
+  while(arenaSize < liveBytes * 2) {
+    arenaSize <<= 1;
+  }
+
+  entries = (OrderedEntry*)malloc(sizeof(OrderedEntry) * capacity);
+  arena = (unsigned char*)malloc(arenaSize);
+  if(index == NULL || entries == NULL || arena == NULL) {
+    free(index);
+    free(entries);
+    free(arena);
+    return false;
+  }
+
+  o->indexMask = indexSize - 1;
+  memset(index, 0xFF, sizeof(int32_t) * indexSize);
+  liveBytes = 0;
+
+  for(n = 0; n < o->numEntries; n++) {
+    OrderedEntry * entry = &o->entries[n];
+    uint32_t perturb = entry->hash;
+    uint32_t i = entry->hash & o->indexMask;
+
+    if(entry->keyOffset == ENTRY_DELETED) {
+      continue;
+    }
+
+    memcpy(arena + liveBytes, o->arena + entry->keyOffset, entry->keySize);
+    entries[numEntries] = *entry;
+    entries[numEntries].keyOffset = liveBytes;
+    liveBytes += entry->keySize;
+
+    /* the new index has no DUMMY slots yet */
+    while(index[i] != IX_EMPTY) {
+      i = next_probe(i, &perturb, o->indexMask);
+    }
+    index[i] = numEntries++;
+  }
+
+  free(o->index);
+  free(o->entries);
+  free(o->arena);
+
+  o->index = index;
+  o->entries = entries;
+  o->numEntries = numEntries;
+  o->capacity = capacity;
+  o->arena = arena;
+  o->arenaUsed = liveBytes;
+  o->arenaSize = arenaSize;
+  ht->tableSize = (int)indexSize;
+
+  /* the first allocation from ordered_init() isn't a rehash */
+  if(!initial) {
+    HT_STAT_REHASHED(ht, start);
+  }
+  return true;
+}
+
+/**
+ * Allocates the engine storage.
+ * tableSize: requested number of index slots, rounded up to a power of two.
+ */
+static bool ordered_init(HT * ht, int tableSize) {
+  Ordered * o = (Ordered*)calloc(1, sizeof(Ordered));
+  uint32_t indexSize = ORDERED_MIN_SIZE;
+
+  if(o == NULL) {
+    return false;
+  }
+
+  while(indexSize < (uint32_t)tableSize) {
+    indexSize <<= 1;
+  }
+
+  ht->engineData = o;
+  if(!ordered_resize(ht, indexSize)) {
+    free(o);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Appends a key that is known not to be in the table, packing or growing
+ * the table first if the entry array is full.
+ * returns: the new entry's number, or -1 on memory allocation error.
+ */
+static long ordered_insert(HT * ht, uint32_t hash, void * key, size_t keySize,
+			   DSValue * value) {
+  Ordered * o = (Ordered*)ht->engineData;
+  OrderedEntry * entry;
+
+  if(keySize > 0xFFFFFFFFUL) {
+    return -1;
+  }
+
+  /* full: repack at a size that leaves the live items half the room */
+  if(o->numEntries == o->capacity
+     && !ordered_resize(ht, fit_index(ht, ht->numItems * 2))) {
+    return -1;
+  }
+
+  if(o->arenaUsed + keySize > o->arenaSize) {
+    size_t arenaSize = o->arenaSize * 2;
+    unsigned char * arena;
+
+    while(arenaSize < o->arenaUsed + keySize) {
+      arenaSize <<= 1;
+    }
+
+    arena = (unsigned char*)realloc(o->arena, arenaSize);
+    if(arena == NULL) {
+      return -1;
+    }
+    o->arena = arena;
+    o->arenaSize = arenaSize;
+  }
+
+  entry = &o->entries[o->numEntries];
+  entry->keyOffset = o->arenaUsed;
+  entry->hash = hash;
+  entry->keySize = (uint32_t)keySize;
+  memcpy(&entry->value, value, sizeof(DSValue));
+  memcpy(o->arena + o->arenaUsed, key, keySize);
+  o->arenaUsed += keySize;
+
+  o->index[find_free_index(o, hash)] = o->numEntries;
+  ht->numItems++;
+
+  return (long)o->numEntries++;
+}
+
+/**
+ * Removes the entry an index slot points at. Nothing moves, so iterators
+ * stay valid.
+ */
+static void ordered_erase(HT * ht, long i) {
+  Ordered * o = (Ordered*)ht->engineData;
+
+  o->entries[o->index[i]].keyOffset = ENTRY_DELETED;
+  o->index[i] = IX_DUMMY;
+  ht->numItems--;
+}
+
+/**
+ * Stores, replaces, or removes (newValue == NULL) a value. Same contract as
+ * ht_put_hashed.
+ */
+static bool ordered_put(HT * ht, uint32_t hash, void * key, size_t keySize,
+			DSValue * newValue, DSValue * oldValue,
+			bool * prevValue) {
+  Ordered * o = (Ordered*)ht->engineData;
+  long found = find_index(o, hash, key, keySize);
+
+  if(prevValue != NULL) {
+    *prevValue = (found >= 0);
+  }
+
+  if(found >= 0) {
+    OrderedEntry * entry = &o->entries[o->index[found]];
+
+    if(oldValue != NULL) {
+      memcpy(oldValue, &entry->value, sizeof(DSValue));
+    }
+
+    if(newValue != NULL) {
+      memcpy(&entry->value, newValue, sizeof(DSValue));
+    } else {
+      ordered_erase(ht, found);
+    }
+    return true;
+  }
+
+  if(newValue == NULL) {
+    return true;
+  }
+
+  return ordered_insert(ht, hash, key, keySize, newValue) >= 0;
+}
+
+/**
+ * Finds a key's value in place, appending it with a zeroed value if it is
+ * missing. Same contract as ht_get_or_insert, except that the pointer is
+ * only valid until the next insert.
+ */
+static DSValue * ordered_get_or_insert(HT * ht, uint32_t hash, void * key,
+				       size_t keySize, bool * inserted) {
+  Ordered * o = (Ordered*)ht->engineData;
+  long found = find_index(o, hash, key, keySize);
+  long n;
+  DSValue zero;
+
+  if(inserted != NULL) {
+    *inserted = false;
+  }
+
+  if(found >= 0) {
+    return &o->entries[o->index[found]].value;
+  }
+
+  memset(&zero, 0, sizeof(DSValue));
+  n = ordered_insert(ht, hash, key, keySize, &zero);
+  if(n < 0) {
+    return NULL;
+  }
+
+  if(inserted != NULL) {
+    *inserted = true;
+  }
+  return &o->entries[n].value;
+}
+
+/**
+ * Looks up a value. Same contract as ht_get_hashed.
+ */
+static bool ordered_get(HT * ht, uint32_t hash, void * key, size_t keySize,
+			DSValue * value) {
+  Ordered * o = (Ordered*)ht->engineData;
+  long found = find_index(o, hash, key, keySize);
+
+  if(found < 0) {
+    return false;
+  }
+
+  if(value != NULL) {
+    memcpy(value, &o->entries[o->index[found]].value, sizeof(DSValue));
+  }
+  return true;
+}
+
+/**
+ * Grows the table so numItems items fit.
+ */
+static bool ordered_reserve(HT * ht, int numItems) {
+  Ordered * o = (Ordered*)ht->engineData;
+
+  if(numItems <= o->capacity) {
+    return true;
+  }
+  return ordered_resize(ht, fit_index(ht, numItems));
+}
+
+/**
+ * Packs the live entries and keys into the smallest table that fits them.
+ */
+static bool ordered_compact(HT * ht) {
+  return ordered_resize(ht, fit_index(ht, ht->numItems));
+}
+
+/**
+ * Positions an iterator at the oldest entry.
+ */
+static void ordered_iter_get(HT * ht, HTIter * i) {
+  i->index = 0;
+}
+
+/**
+ * Advances the iterator past removed entries.
+ */
+static bool ordered_iter_has_next(HTIter * i) {
+  Ordered * o = (Ordered*)i->instance->engineData;
+
+  while(i->index < o->numEntries
+	&& o->entries[i->index].keyOffset == ENTRY_DELETED) {
+    i->index++;
+  }
+  return i->index < o->numEntries;
+}
+
+/**
+ * Copies out the next item in insertion order and optionally removes it.
+ */
+static bool ordered_iter_next(HTIter * i, void * keyBuffer,
+			      size_t keyBufferLen, DSValue * value,
+			      size_t * keyLen, bool remove) {
+  Ordered * o = (Ordered*)i->instance->engineData;
+  OrderedEntry * entry;
+
+  if(!ordered_iter_has_next(i)) {
+    return false;
+  }
+
+  entry = &o->entries[i->index];
+
+  if(keyBuffer != NULL) {
+    memcpy(keyBuffer, o->arena + entry->keyOffset,
+	   keyBufferLen < entry->keySize ? keyBufferLen : entry->keySize);
+
+    if(keyLen != NULL) {
+      *keyLen = entry->keySize;
+    }
+  }
+
+  if(value != NULL) {
+    memcpy(value, &entry->value, sizeof(DSValue));
+  }
+
+  if(remove) {
+    ordered_erase(i->instance, find_index(o, entry->hash,
+					  o->arena + entry->keyOffset,
+					  entry->keySize));
+  }
+
+  i->index++;
+  return true;
+}
+
+/**
+ * Frees the engine storage.
+ */
+static void ordered_free(HT * ht) {
+  Ordered * o = (Ordered*)ht->engineData;
+
+  free(o->index);
+  free(o->entries);
+  free(o->arena);
+  free(o);
+}
+
+const HTEngineOps ht_ordered_ops = {
+  ordered_init,
+  ordered_put,
+  ordered_get,
+  ordered_get_or_insert,
+  ordered_reserve,
+  ordered_compact,
+  ordered_iter_get,
+  ordered_iter_has_next,
+  ordered_iter_next,
+  ordered_free
+};
@@ -0,0 +1,146 @@
+/**
+ * HashTable Statistics
+ * (C) 2013 Christian Gunderman
+ *
+ * Counters are kept in the table only when DATASTRUCT_ENABLE_STATS is
+ * defined, see build_config.h. The chain figures are computed on demand by
+ * walking the buckets, so they cost nothing until asked for.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include "ht_internal.h"
+
+#ifdef DATASTRUCT_ENABLE_STATS
+/**
+ * Adds the chains of one bucket array to stats.
+ */
+static void count_chains(HT * ht, HTNode ** table, size_t tableSize,
+			 HTStats * stats) {
+  size_t i;
+
+  stats->bytesAllocated += sizeof(HTNode*) * tableSize;
+
+  for(i = 0; i < tableSize; i++) {
+    HTNode * node;
+    int length = 0;
+
+    for(node = table[i]; node != NULL; node = node->next) {
+      if(ht->nodePool == NULL || node->keySize > HT_POOL_KEY_SIZE) {
+	stats->bytesAllocated += sizeof(HTNode) + node->keySize;
+      }
+      length++;
+    }
+
+    if(length == 0) {
+      stats->emptyBuckets++;
+    }
+    if(length > stats->longestChain) {
+      stats->longestChain = length;
+    }
+    stats->chainLengths[length < HT_STATS_MAX_CHAIN
+			? length : HT_STATS_MAX_CHAIN]++;
+  }
+}
+#endif /* DATASTRUCT_ENABLE_STATS */
+
+/**
+ * Gets the counters and the shape of a table. The chain histogram, empty
+ * buckets and bytes allocated describe HT_ENGINE_CHAINED tables only, and
+ * are zero for other engines. Gets made by lock-free readers are not
+ * counted. Walks every bucket, so it is O(tableSize).
+ * ht: the hashtable instance.
+ * stats: receives the statistics.
+ * returns: false if the library was built without DATASTRUCT_ENABLE_STATS.
+ */
+bool ht_stats(HT * ht, HTStats * stats) {
+#ifdef DATASTRUCT_ENABLE_STATS
+  memset(stats, 0, sizeof(HTStats));
+  stats->counters = ht->counters;
+  stats->numItems = ht->numItems;
+  stats->tableSize = ht->tableSize;
+
+  if(ht->ops != NULL) {
+    return true;
+  }
+
+  count_chains(ht, ht->table, ht->tableSize, stats);
+  if(ht->oldTable != NULL) {
+    count_chains(ht, ht->oldTable, ht->oldTableSize, stats);
+  }
+
+  if(ht->nodePool != NULL) {
+    stats->bytesAllocated += ht->nodePool->numBytes;
+  }
+  return true;
+#else
+  memset(stats, 0, sizeof(HTStats));
+  return false;
+#endif /* DATASTRUCT_ENABLE_STATS */
+}
+
+/**
+ * Zeroes a table's counters, eg. between the phases of a benchmark.
+ * ht: the hashtable instance.
+ */
+void ht_stats_reset(HT * ht) {
+#ifdef DATASTRUCT_ENABLE_STATS
+  memset(&ht->counters, 0, sizeof(HTCounters));
+#endif /* DATASTRUCT_ENABLE_STATS */
+}
+
+/**
+ * Writes ht_stats() to a file as a single JSON object.
+ * ht: the hashtable instance.
+ * file: the file to write to, eg. stderr.
+ * returns: false if stats are compiled out or the write fails.
+ */
+bool ht_stats_dump(HT * ht, FILE * file) {
+  HTStats stats;
+  unsigned long numBuckets = 0;
+  int i;
+
+  if(!ht_stats(ht, &stats)) {
+    return false;
+  }
+
+  /* counts an old table still being rehashed as well */
+  for(i = 0; i <= HT_STATS_MAX_CHAIN; i++) {
+    numBuckets += stats.chainLengths[i];
+  }
+
+  fprintf(file, "{\"numItems\": %d, \"tableSize\": %d, ",
+	  stats.numItems, stats.tableSize);
+  fprintf(file, "\"lookups\": %lu, \"hits\": %lu, \"misses\": %lu, ",
+	  stats.counters.lookups, stats.counters.hits, stats.counters.misses);
+  fprintf(file, "\"nodesVisited\": %lu, \"keyCompares\": %lu, ",
+	  stats.counters.nodesVisited, stats.counters.keyCompares);
+  fprintf(file, "\"rehashes\": %lu, \"rehashSeconds\": %f, ",
+	  stats.counters.rehashes, stats.counters.rehashSeconds);
+  fprintf(file, "\"emptyBuckets\": %d, \"emptyFraction\": %f, ",
+	  stats.emptyBuckets, numBuckets > 0
+	  ? (double)stats.emptyBuckets / numBuckets : 0.0);
+  fprintf(file, "\"longestChain\": %d, \"chainLengths\": [",
+	  stats.longestChain);
+
+  for(i = 0; i <= HT_STATS_MAX_CHAIN; i++) {
+    fprintf(file, i == 0 ? "%lu" : ", %lu", stats.chainLengths[i]);
+  }
+
+  fprintf(file, "], \"bytesAllocated\": %lu}\n",
+	  (unsigned long)stats.bytesAllocated);
+  return !ferror(file);
+}
@@ -0,0 +1,565 @@
+/**
+ * Open Addressing HashTable Engine
+ * (C) 2013 Christian Gunderman
+ *
+ * SwissTable style storage behind the HT interface. Each slot has a one
+ * byte control tag holding either EMPTY, DELETED, or the low 7 bits of the
+ * key's hash. Slots are probed a group of 16 at a time; on SSE2 capable
+ * machines a whole group is matched with a single compare, so most lookups
+ * touch one control group and one slot and never call memcmp on a miss.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include "ht_internal.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+
+#define SWISS_GROUP_SIZE 16
+#define SWISS_MAX_LOAD 0.875f
+#define CTRL_EMPTY ((signed char)-128)
+#define CTRL_DELETED ((signed char)-2)
+
+/* keys up to HT_POOL_KEY_SIZE bytes live in the slot itself */
+#define SWISS_KEY_INLINE(keySize) ((keySize) <= HT_POOL_KEY_SIZE)
+
+/* a single key/value slot */
+typedef struct SwissSlot {
+  union {
+    char bytes[HT_POOL_KEY_SIZE];
+    void * heap;
+  } key;
+  size_t keySize;
+  uint32_t hash;
+  DSValue value;
+} SwissSlot;
+
+/* engine storage, hung off of ht->engineData */
+typedef struct Swiss {
+  signed char * ctrl;
+  SwissSlot * slots;
+  size_t numGroups;
+  size_t growthLeft;
+} Swiss;
+
+/**
+ * Gets the control tag stored for a hash.
+ */
+static signed char hash_tag(uint32_t hash) {
+  return (signed char)(hash & 0x7F);
+}
+
+/**
+ * Gets a slot's key bytes, wherever they're stored.
+ */
+static void * slot_key(SwissSlot * slot) {
+  return SWISS_KEY_INLINE(slot->keySize) ? slot->key.bytes : slot->key.heap;
+}
+
+/**
+ * Builds a bitmask with bit n set when group[n] == tag.
+ */
+static unsigned int group_match(signed char * group, signed char tag) {
+#ifdef __SSE2__
+  __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+  return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl,
+							_mm_set1_epi8(tag)));
+#else
+  unsigned int mask = 0;
+  int n;
+
+  for(n = 0; n < SWISS_GROUP_SIZE; n++) {
+    if(group[n] == tag) {
+      mask |= 1u << n;
+    }
+  }
+  return mask;
+#endif /* __SSE2__ */
+}
+
+/**
+ * Builds a bitmask with bit n set when group[n] is EMPTY or DELETED.
+ * Both have their high bit set while full slots never do.
+ */
+static unsigned int group_free(signed char * group) {
+#ifdef __SSE2__
+  return (unsigned int)_mm_movemask_epi8(
+	   _mm_loadu_si128((const __m128i*)group));
+#else
+  unsigned int mask = 0;
+  int n;
+
+  for(n = 0; n < SWISS_GROUP_SIZE; n++) {
+    if(group[n] < 0) {
+      mask |= 1u << n;
+    }
+  }
+  return mask;
+#endif /* __SSE2__ */
+}
+
+/**
+ * Gets the index of the lowest set bit in a non-zero mask.
+ */
+static int lowest_bit(unsigned int mask) {
+#ifdef __GNUC__
+  return __builtin_ctz(mask);
+#else
+  int n = 0;
+
+  while((mask & 1u) == 0) {
+    mask >>= 1;
+    n++;
+  }
+  return n;
+#endif /* __GNUC__ */
+}
+
+/**
+ * Gets the maximum load for this table. Open addressing degrades quickly
+ * past 7/8 full, so the HT's load factor is clamped to that.
+ */
+static float swiss_max_load(HT * ht) {
+  if(ht->loadFactor <= 0.0f || ht->loadFactor > SWISS_MAX_LOAD) {
+    return SWISS_MAX_LOAD;
+  }
+  return ht->loadFactor;
+}
+
+/**
+ * Computes how many more items can be placed in fresh EMPTY slots before
+ * the table has to be rehashed.
+ */
+static size_t swiss_capacity_left(HT * ht, size_t numGroups) {
+  size_t limit = (size_t)(numGroups * SWISS_GROUP_SIZE * swiss_max_load(ht));
+
+  if(limit == 0) {
+    limit = 1;
+  }
+  return limit > (size_t)ht->numItems ? limit - ht->numItems : 0;
+}
+
+/**
+ * Allocates empty control and slot arrays.
+ * returns: false on memory allocation error.
+ */
+static bool swiss_alloc(Swiss * s, size_t numGroups) {
+  size_t capacity = numGroups * SWISS_GROUP_SIZE;
+
+  s->ctrl = (signed char*)malloc(capacity);
+  if(s->ctrl == NULL) {
+    return false;
+  }
+
+  s->slots = (SwissSlot*)calloc(capacity, sizeof(SwissSlot));
+  if(s->slots == NULL) {
+    free(s->ctrl);
+    return false;
+  }
+
+  memset(s->ctrl, CTRL_EMPTY, capacity);
+  s->numGroups = numGroups;
+  return true;
+}
+
+/**
+ * Finds the first EMPTY or DELETED slot along the probe sequence of hash.
+ * The table always has at least one free slot, so this terminates.
+ */
+static size_t find_insert_slot(Swiss * s, uint32_t hash) {
+  size_t mask = s->numGroups - 1;
+  size_t group = (hash >> 7) & mask;
+  size_t step = 1;
+
+  for(;;) {
+    unsigned int freeMask = group_free(s->ctrl + group * SWISS_GROUP_SIZE);
+
+    if(freeMask != 0) {
+      return group * SWISS_GROUP_SIZE + lowest_bit(freeMask);
+    }
+
+    /* triangular probing visits every group of a power of two table */
+    group = (group + step) & mask;
+    step++;
+  }
+}
+
+/**
+ * Finds the slot holding key.
+ * returns: the slot index, or -1 if the key is not in the table.
+ */
+static long find_slot(Swiss * s, uint32_t hash, void * key, size_t keySize) {
+  size_t mask = s->numGroups - 1;
+  size_t group = (hash >> 7) & mask;
+  size_t step = 1;
+  signed char tag = hash_tag(hash);
+
+  for(;;) {
+    signed char * ctrl = s->ctrl + group * SWISS_GROUP_SIZE;
+    unsigned int match = group_match(ctrl, tag);
+
+    /* compare only the slots whose tag matched */
+    while(match != 0) {
+      size_t n = group * SWISS_GROUP_SIZE + lowest_bit(match);
+      SwissSlot * slot = &s->slots[n];
+
+      if(slot->hash == hash && slot->keySize == keySize
+	 && memcmp(slot_key(slot), key, keySize) == 0) {
+	return (long)n;
+      }
+      match &= match - 1;
+    }
+
+    /* an EMPTY slot in the group ends the probe sequence */
+    if(group_match(ctrl, CTRL_EMPTY) != 0) {
+      return -1;
+    }
+
+    group = (group + step) & mask;
+    step++;
+  }
+}
+
+/**
+ * Rehashes all items into new arrays of numGroups groups. Stored hashes are
+ * reused, so no keys are read.
+ * returns: false on memory allocation error; the table is left unchanged.
+ */
+static bool swiss_rehash(HT * ht, size_t numGroups) {
+  clock_t start = HT_STAT_CLOCK();
+  Swiss * s = (Swiss*)ht->engineData;
+  Swiss old = *s;
+  size_t oldCapacity = old.numGroups * SWISS_GROUP_SIZE;
+  size_t n;
+
+  if(!swiss_alloc(s, numGroups)) {
+    *s = old;
+    return false;
+  }
+
+  for(n = 0; n < oldCapacity; n++) {
+    if(old.ctrl[n] >= 0) {
+      size_t dst = find_insert_slot(s, old.slots[n].hash);
+
+      s->ctrl[dst] = old.ctrl[n];
+      s->slots[dst] = old.slots[n];
+    }
+  }
+
+  s->growthLeft = swiss_capacity_left(ht, numGroups);
+  ht->tableSize = (int)(numGroups * SWISS_GROUP_SIZE);
+
+  free(old.ctrl);
+  free(old.slots);
+  HT_STAT_REHASHED(ht, start);
+  return true;
+}
+
+/**
+ * Marks a slot free. If its group already has an EMPTY slot no probe
+ * sequence can pass through the group, so the slot can go straight back
+ * to EMPTY instead of leaving a tombstone.
+ */
+static void swiss_erase(HT * ht, size_t n) {
+  Swiss * s = (Swiss*)ht->engineData;
+  signed char * group = s->ctrl + (n / SWISS_GROUP_SIZE) * SWISS_GROUP_SIZE;
+
+  if(!SWISS_KEY_INLINE(s->slots[n].keySize)) {
+    free(s->slots[n].key.heap);
+    s->slots[n].key.heap = NULL;
+  }
+
+  if(group_match(group, CTRL_EMPTY) != 0) {
+    s->ctrl[n] = CTRL_EMPTY;
+    s->growthLeft++;
+  } else {
+    s->ctrl[n] = CTRL_DELETED;
+  }
+  ht->numItems--;
+}
+
+/**
+ * Allocates the engine storage.
+ * tableSize: requested number of slots, rounded up to a power of two
+ * number of groups.
+ */
+static bool swiss_init(HT * ht, int tableSize) {
+  Swiss * s = (Swiss*)calloc(1, sizeof(Swiss));
+  size_t numGroups = 1;
+
+  if(s == NULL) {
+    return false;
+  }
+
+  while(numGroups * SWISS_GROUP_SIZE < (size_t)tableSize) {
+    numGroups <<= 1;
+  }
+
+  if(!swiss_alloc(s, numGroups)) {
+    free(s);
+    return false;
+  }
+
+  ht->engineData = s;
+  ht->tableSize = (int)(numGroups * SWISS_GROUP_SIZE);
+  s->growthLeft = swiss_capacity_left(ht, numGroups);
+  return true;
+}
+
+/**
+ * Inserts a key that is known not to be in the table, growing it first if
+ * needed. The top 25 bits of the hash select the starting group and the
+ * low 7 bits become the control tag.
+ * returns: the new slot's index, or -1 on memory allocation error.
+ */
+static long swiss_insert(HT * ht, uint32_t hash, void * key, size_t keySize,
+			 DSValue * value) {
+  Swiss * s = (Swiss*)ht->engineData;
+  size_t n;
+
+  /* out of fresh slots: purge tombstones if they're the problem, else grow */
+  if(s->growthLeft == 0) {
+    size_t numGroups = s->numGroups;
+
+    if((size_t)ht->numItems * 2 > numGroups * SWISS_GROUP_SIZE
+       * swiss_max_load(ht)) {
+      numGroups <<= 1;
+    }
+    if(!swiss_rehash(ht, numGroups)) {
+      return -1;
+    }
+  }
+
+  n = find_insert_slot(s, hash);
+  if(!SWISS_KEY_INLINE(keySize)) {
+    s->slots[n].key.heap = malloc(keySize);
+    if(s->slots[n].key.heap == NULL) {
+      return -1;
+    }
+  }
+
+  s->slots[n].keySize = keySize;
+  memcpy(slot_key(&s->slots[n]), key, keySize);
+  s->slots[n].hash = hash;
+  memcpy(&s->slots[n].value, value, sizeof(DSValue));
+
+  if(s->ctrl[n] == CTRL_EMPTY) {
+    s->growthLeft--;
+  }
+  s->ctrl[n] = hash_tag(hash);
+  ht->numItems++;
+
+  return (long)n;
+}
+
+/**
+ * Stores, replaces, or removes (newValue == NULL) a value. Same contract as
+ * ht_put_hashed.
+ */
+static bool swiss_put(HT * ht, uint32_t hash, void * key, size_t keySize,
+		      DSValue * newValue, DSValue * oldValue, bool * prevValue) {
+  Swiss * s = (Swiss*)ht->engineData;
+  long found = find_slot(s, hash, key, keySize);
+
+  if(prevValue != NULL) {
+    *prevValue = (found >= 0);
+  }
+
+  if(found >= 0) {
+    if(oldValue != NULL) {
+      memcpy(oldValue, &s->slots[found].value, sizeof(DSValue));
+    }
+
+    if(newValue != NULL) {
+      memcpy(&s->slots[found].value, newValue, sizeof(DSValue));
+    } else {
+      swiss_erase(ht, (size_t)found);
+    }
+    return true;
+  }
+
+  if(newValue == NULL) {
+    return true;
+  }
+
+  return swiss_insert(ht, hash, key, keySize, newValue) >= 0;
+}
+
+/**
+ * Finds a key's value in place, inserting it with a zeroed value if it is
+ * missing. Same contract as ht_get_or_insert, except that the pointer is
+ * only valid until the next insert.
+ */
+static DSValue * swiss_get_or_insert(HT * ht, uint32_t hash, void * key,
+				     size_t keySize, bool * inserted) {
+  Swiss * s = (Swiss*)ht->engineData;
+  long found = find_slot(s, hash, key, keySize);
+  DSValue zero;
+
+  if(inserted != NULL) {
+    *inserted = false;
+  }
+
+  if(found < 0) {
+    memset(&zero, 0, sizeof(DSValue));
+    found = swiss_insert(ht, hash, key, keySize, &zero);
+
+    if(found >= 0 && inserted != NULL) {
+      *inserted = true;
+    }
+  }
+
+  return found >= 0 ? &s->slots[found].value : NULL;
+}
+
+/**
+ * Looks up a value. Same contract as ht_get_hashed.
+ */
+static bool swiss_get(HT * ht, uint32_t hash, void * key, size_t keySize,
+		      DSValue * value) {
+  Swiss * s = (Swiss*)ht->engineData;
+  long found = find_slot(s, hash, key, keySize);
+
+  if(found < 0) {
+    return false;
+  }
+
+  if(value != NULL) {
+    memcpy(value, &s->slots[found].value, sizeof(DSValue));
+  }
+  return true;
+}
+
+/**
+ * Grows the table so numItems items fit without rehashing.
+ */
+static bool swiss_reserve(HT * ht, int numItems) {
+  Swiss * s = (Swiss*)ht->engineData;
+  size_t numGroups = s->numGroups;
+
+  while(numGroups * SWISS_GROUP_SIZE * swiss_max_load(ht) <= (float)numItems) {
+    numGroups <<= 1;
+  }
+
+  if(numGroups == s->numGroups) {
+    return true;
+  }
+  return swiss_rehash(ht, numGroups);
+}
+
+/**
+ * Rehashes into the fewest groups that hold the items, which also clears
+ * every tombstone.
+ */
+static bool swiss_compact(HT * ht) {
+  size_t numGroups = 1;
+
+  while(numGroups * SWISS_GROUP_SIZE * swiss_max_load(ht)
+	<= (float)ht->numItems) {
+    numGroups <<= 1;
+  }
+
+  return swiss_rehash(ht, numGroups);
+}
+
+/**
+ * Positions an iterator at slot 0.
+ */
+static void swiss_iter_get(HT * ht, HTIter * i) {
+  i->index = 0;
+}
+
+/**
+ * Advances the iterator to the next full slot, if any.
+ */
+static bool swiss_iter_has_next(HTIter * i) {
+  Swiss * s = (Swiss*)i->instance->engineData;
+
+  while(i->index < i->instance->tableSize && s->ctrl[i->index] < 0) {
+    i->index++;
+  }
+  return i->index < i->instance->tableSize;
+}
+
+/**
+ * Copies out the next item and optionally removes it. Removal never moves
+ * other slots, so iteration stays valid.
+ */
+static bool swiss_iter_next(HTIter * i, void * keyBuffer, size_t keyBufferLen,
+			    DSValue * value, size_t * keyLen, bool remove) {
+  Swiss * s = (Swiss*)i->instance->engineData;
+  SwissSlot * slot;
+
+  if(!swiss_iter_has_next(i)) {
+    return false;
+  }
+
+  slot = &s->slots[i->index];
+
+  if(keyBuffer != NULL) {
+    memcpy(keyBuffer, slot_key(slot),
+	   keyBufferLen < slot->keySize ? keyBufferLen : slot->keySize);
+
+    if(keyLen != NULL) {
+      *keyLen = slot->keySize;
+    }
+  }
+
+  if(value != NULL) {
+    memcpy(value, &slot->value, sizeof(DSValue));
+  }
+
+  if(remove) {
+    swiss_erase(i->instance, (size_t)i->index);
+  }
+
+  i->index++;
+  return true;
+}
+
+/**
+ * Frees every heap allocated key and the engine storage.
+ */
+static void swiss_free(HT * ht) {
+  Swiss * s = (Swiss*)ht->engineData;
+  size_t capacity = s->numGroups * SWISS_GROUP_SIZE;
+  size_t n;
+
+  for(n = 0; n < capacity; n++) {
+    if(s->ctrl[n] >= 0 && !SWISS_KEY_INLINE(s->slots[n].keySize)) {
+      free(s->slots[n].key.heap);
+    }
+  }
+
+  free(s->ctrl);
+  free(s->slots);
+  free(s);
+}
+
+const HTEngineOps ht_swiss_ops = {
+  swiss_init,
+  swiss_put,
+  swiss_get,
+  swiss_get_or_insert,
+  swiss_reserve,
+  swiss_compact,
+  swiss_iter_get,
+  swiss_iter_has_next,
+  swiss_iter_next,
+  swiss_free
+};
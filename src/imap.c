@@ -0,0 +1,395 @@
+/**
+ * Integer Keyed HashMap
+ * (C) 2013 Christian Gunderman
+ *
+ * A hashmap specialized for 64-bit integer keys, with the same put, get and
+ * iterate shape as ht.c. Keys and values live inline in one flat array of
+ * slots, so a put allocates nothing and a get is one multiply, a shift and
+ * a short linear probe comparing integers. A parallel array of state bytes
+ * marks each slot empty, full, or deleted (a tombstone, so that probes for
+ * other keys keep going past it).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include "imap.h"
+
+/* slot states */
+#define IMAP_EMPTY 0
+#define IMAP_FULL 1
+#define IMAP_DELETED 2
+
+/* smallest table, and highest load factor that still leaves probes short */
+#define IMAP_MIN_SIZE 8
+#define IMAP_MAX_LOAD 0.9f
+
+/* builds a 64-bit constant from two halves, C89 has no 64-bit literals */
+#define U64(hi, lo) (((uint64_t)(hi) << 32) | (uint64_t)(lo))
+
+/**
+ * Maps a key to its home slot by multiply-shift (Fibonacci) hashing: the
+ * multiply mixes every key bit into the top bits, which become the index.
+ * m: the map instance.
+ * key: the key.
+ */
+static int slot_index(IMap * m, uint64_t key) {
+  return (int)((key * U64(0x9e3779b9, 0x7f4a7c15)) >> m->shift);
+}
+
+/**
+ * Allocates empty slot arrays of tableSize slots and installs them.
+ * returns: false on memory allocation error, and the map is unchanged.
+ */
+static bool alloc_slots(IMap * m, int tableSize) {
+  IMapSlot * slots = (IMapSlot*)malloc(sizeof(IMapSlot) * tableSize);
+  unsigned char * states = (unsigned char*)calloc(tableSize, 1);
+  int shift = 64;
+  int n;
+
+  if(slots == NULL || states == NULL) {
+    free(slots);
+    free(states);
+    return false;
+  }
+
+  for(n = tableSize; n > 1; n >>= 1) {
+    shift--;
+  }
+
+  m->slots = slots;
+  m->states = states;
+  m->tableSize = tableSize;
+  m->shift = shift;
+  m->numDeleted = 0;
+  return true;
+}
+
+/**
+ * Creates a new integer keyed hashmap.
+ * tableSize: initial number of slots, rounded up to a power of two.
+ * loadFactor: fraction of slots, counting deleted ones, that may be used
+ * before the map is rehashed. Clamped to 0.9.
+ * returns: a new IMap, or NULL on memory allocation error.
+ */
+IMap * imap_new(int tableSize, float loadFactor) {
+  IMap * m = (IMap*)calloc(1, sizeof(IMap));
+  int size = IMAP_MIN_SIZE;
+
+  if(m == NULL) {
+    return NULL;
+  }
+
+  while(size < tableSize) {
+    size <<= 1;
+  }
+
+  m->loadFactor = loadFactor > IMAP_MAX_LOAD || loadFactor <= 0
+    ? IMAP_MAX_LOAD : loadFactor;
+
+  if(!alloc_slots(m, size)) {
+    free(m);
+    return NULL;
+  }
+
+  return m;
+}
+
+/**
+ * Finds the slot holding a key.
+ * returns: the slot index, or -1 if the key isn't in the map.
+ */
+static int find_slot(IMap * m, uint64_t key) {
+  int mask = m->tableSize - 1;
+  int i = slot_index(m, key);
+
+  while(m->states[i] != IMAP_EMPTY) {
+    if(m->states[i] == IMAP_FULL && m->slots[i].key == key) {
+      return i;
+    }
+    i = (i + 1) & mask;
+  }
+
+  return -1;
+}
+
+/**
+ * Moves every item into new arrays of tableSize slots, dropping tombstones.
+ * returns: false on memory allocation error, and the map is unchanged.
+ */
+static bool rehash(IMap * m, int tableSize) {
+  IMapSlot * oldSlots = m->slots;
+  unsigned char * oldStates = m->states;
+  int oldSize = m->tableSize;
+  int n;
+
+  if(!alloc_slots(m, tableSize)) {
+    return false;
+  }
+
+  for(n = 0; n < oldSize; n++) {
+    if(oldStates[n] == IMAP_FULL) {
+      int i = slot_index(m, oldSlots[n].key);
+
+      while(m->states[i] != IMAP_EMPTY) {
+	i = (i + 1) & (tableSize - 1);
+      }
+      m->slots[i] = oldSlots[n];
+      m->states[i] = IMAP_FULL;
+    }
+  }
+
+  free(oldSlots);
+  free(oldStates);
+  return true;
+}
+
+/**
+ * Makes room for one more item. If tombstones are most of the load the map
+ * is rehashed at the same size to clear them, otherwise it doubles.
+ * returns: false on memory allocation error.
+ */
+static bool check_load_factor(IMap * m) {
+  float limit = m->tableSize * m->loadFactor;
+
+  if(m->numItems + m->numDeleted + 1 <= limit) {
+    return true;
+  }
+
+  return rehash(m, m->numItems + 1 > limit / 2
+		? m->tableSize * 2 : m->tableSize);
+}
+
+/**
+ * Inserts a key known not to be in the map.
+ * returns: the new slot's index, or -1 on memory allocation error.
+ */
+static int insert_slot(IMap * m, uint64_t key, DSValue * value) {
+  int mask;
+  int i;
+
+  if(!check_load_factor(m)) {
+    return -1;
+  }
+
+  /* reuse the first tombstone or empty slot on the key's probe sequence */
+  mask = m->tableSize - 1;
+  i = slot_index(m, key);
+  while(m->states[i] == IMAP_FULL) {
+    i = (i + 1) & mask;
+  }
+
+  if(m->states[i] == IMAP_DELETED) {
+    m->numDeleted--;
+  }
+
+  m->slots[i].key = key;
+  memcpy(&m->slots[i].value, value, sizeof(DSValue));
+  m->states[i] = IMAP_FULL;
+  m->numItems++;
+
+  return i;
+}
+
+/**
+ * Marks a slot deleted.
+ */
+static void remove_slot(IMap * m, int i) {
+  m->states[i] = IMAP_DELETED;
+  m->numDeleted++;
+  m->numItems--;
+}
+
+/**
+ * Stores a value. Same contract as ht_put_raw_key().
+ * m: the map instance.
+ * key: the key which the value will be stored under.
+ * newValue: A pointer to a new value to store. If this value is NULL, the
+ * item at the specified key is removed.
+ * oldValue: A buffer that will recv. the old value, or NULL.
+ * prevValue: recv. whether or not the key previously had a value, or NULL.
+ * return: true on success, or false on memory allocation error.
+ */
+bool imap_put(IMap * m, uint64_t key, DSValue * newValue,
+	      DSValue * oldValue, bool * prevValue) {
+  int i = find_slot(m, key);
+
+  if(prevValue != NULL) {
+    *prevValue = (i >= 0);
+  }
+
+  if(i >= 0) {
+    if(oldValue != NULL) {
+      memcpy(oldValue, &m->slots[i].value, sizeof(DSValue));
+    }
+
+    if(newValue != NULL) {
+      memcpy(&m->slots[i].value, newValue, sizeof(DSValue));
+    } else {
+      remove_slot(m, i);
+    }
+    return true;
+  }
+
+  if(newValue == NULL) {
+    return true;
+  }
+
+  return insert_slot(m, key, newValue) >= 0;
+}
+
+/**
+ * Gets a value. Same contract as ht_get_raw_key().
+ * m: the map instance.
+ * key: the key at which the value will be looked up.
+ * value: recv. the stored value if it exists, or NULL.
+ * returns: true if the specified value exists and false if it does not.
+ */
+bool imap_get(IMap * m, uint64_t key, DSValue * value) {
+  int i = find_slot(m, key);
+
+  if(i < 0) {
+    return false;
+  }
+
+  if(value != NULL) {
+    memcpy(value, &m->slots[i].value, sizeof(DSValue));
+  }
+  return true;
+}
+
+/**
+ * Gets a pointer to a key's stored value, inserting the key with a zeroed
+ * value if it is missing. Values move when the map grows, so the pointer
+ * is only valid until the next insert.
+ * m: the map instance.
+ * key: the key to look up or insert.
+ * inserted: recv. true if the key was inserted by this call, or NULL.
+ * returns: a pointer to the key's value, or NULL on memory allocation error.
+ */
+DSValue * imap_get_or_insert(IMap * m, uint64_t key, bool * inserted) {
+  int i = find_slot(m, key);
+  DSValue zero;
+
+  if(inserted != NULL) {
+    *inserted = (i < 0);
+  }
+
+  if(i < 0) {
+    memset(&zero, 0, sizeof(DSValue));
+    i = insert_slot(m, key, &zero);
+    if(i < 0) {
+      return NULL;
+    }
+  }
+
+  return &m->slots[i].value;
+}
+
+/**
+ * Grows the map so that numItems items fit without any further rehashing.
+ * m: the map instance.
+ * numItems: the number of items the map must hold.
+ * returns: false on memory allocation error, and the map is unchanged.
+ */
+bool imap_reserve(IMap * m, int numItems) {
+  int size = m->tableSize;
+
+  while(numItems + 1 > size * m->loadFactor) {
+    size <<= 1;
+  }
+
+  if(size == m->tableSize) {
+    return true;
+  }
+  return rehash(m, size);
+}
+
+/**
+ * Gets an iterator for this map. The map must not be added to while
+ * iterating, but items may be removed through the iterator.
+ * m: the map instance.
+ * i: A pointer to a buffer that will recv. the iterator.
+ */
+void imap_iter_get(IMap * m, IMapIter * i) {
+  i->instance = m;
+  i->index = 0;
+}
+
+/**
+ * Checks the iterator for items that have not been iterated over yet.
+ * i: an iterator.
+ * returns: true if items remain, and false if no items remain.
+ */
+bool imap_iter_has_next(IMapIter * i) {
+  IMap * m = i->instance;
+
+  while(i->index < m->tableSize && m->states[i->index] != IMAP_FULL) {
+    i->index++;
+  }
+
+  return i->index < m->tableSize;
+}
+
+/**
+ * Gets the next item in the map.
+ * i: an iterator.
+ * key: recv. the item's key, or NULL.
+ * value: recv. the item's value, or NULL.
+ * remove: if true, removes the item from the map.
+ * returns: true if an uniterated item was found and written to the buffers.
+ */
+bool imap_iter_next(IMapIter * i, uint64_t * key, DSValue * value,
+		    bool remove) {
+  IMap * m = i->instance;
+
+  if(!imap_iter_has_next(i)) {
+    return false;
+  }
+
+  if(key != NULL) {
+    *key = m->slots[i->index].key;
+  }
+  if(value != NULL) {
+    memcpy(value, &m->slots[i->index].value, sizeof(DSValue));
+  }
+
+  /* leaves a tombstone, so nothing moves under the iterator */
+  if(remove) {
+    remove_slot(m, i->index);
+  }
+
+  i->index++;
+  return true;
+}
+
+/**
+ * Gets the number of items in the map.
+ * m: the map instance.
+ * returns: the number of items.
+ */
+int imap_size(IMap * m) {
+  return m->numItems;
+}
+
+/**
+ * Frees the map. Pointers stored as values are not freed.
+ * m: the map instance.
+ */
+void imap_free(IMap * m) {
+  free(m->slots);
+  free(m->states);
+  free(m);
+}
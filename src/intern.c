@@ -0,0 +1,185 @@
+/**
+ * String Interning Table
+ * (C) 2013 Christian Gunderman
+ *
+ * Maps byte strings to dense 32-bit IDs, 0, 1, 2..., in the order they are
+ * first added, and IDs back to strings. Each string is stored exactly once,
+ * as the key of a node in a chained HT. Nodes are never moved or freed
+ * until the table is, so the nodes double as an append-only arena: short
+ * strings are carved from the HT's node pool slabs, and an ID's string
+ * pointer stays valid for the life of the table. Tables and sets keyed by
+ * IDs (imap.c, iset.c) then hash and compare 4 byte integers instead of
+ * strings, and share this one copy of each string.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include <stddef.h>
+#include "intern.h"
+
+#ifdef DATASTRUCT_ENABLE_INT
+
+/* string nodes allocated at a time */
+#define INTERN_NODES_PER_SLAB 256
+
+/* initial size of the ID array */
+#define INTERN_MIN_CAPACITY 64
+
+/**
+ * Gets the node a value pointer from ht_get_or_insert() belongs to.
+ */
+static HTNode * value_node(DSValue * value) {
+  return (HTNode*)((char*)value - offsetof(HTNode, value));
+}
+
+/**
+ * Creates a new interning table.
+ * tableSize: the initial number of buckets.
+ * returns: a new Intern, or NULL on memory allocation error.
+ */
+Intern * intern_new(int tableSize) {
+  Intern * in = (Intern*)calloc(1, sizeof(Intern));
+  HTOptions options;
+
+  if(in == NULL) {
+    return NULL;
+  }
+
+  /* strings are often untrusted input, so use a per-table seed */
+  ht_options_init(&options);
+  options.nodesPerSlab = INTERN_NODES_PER_SLAB;
+  options.randomSeed = true;
+
+  in->ht = ht_new_ex(tableSize, tableSize, 0.75, &options);
+  in->nodes = (HTNode**)malloc(sizeof(HTNode*) * INTERN_MIN_CAPACITY);
+  if(in->ht == NULL || in->nodes == NULL) {
+    if(in->ht != NULL) {
+      ht_free(in->ht);
+    }
+    free(in->nodes);
+    free(in);
+    return NULL;
+  }
+
+  in->capacity = INTERN_MIN_CAPACITY;
+  return in;
+}
+
+/**
+ * Gets a string's ID, adding the string if it hasn't been seen before.
+ * Costs one hash lookup either way.
+ * in: the interning table instance.
+ * str: the string, which need not be null terminated.
+ * len: the number of bytes in str.
+ * id: receives the ID.
+ * returns: false on memory allocation error, or if 2^31 strings have
+ * already been added.
+ */
+bool intern_add(Intern * in, void * str, size_t len, uint32_t * id) {
+  DSValue * value;
+  bool inserted;
+
+  /* make room for a new ID first, so a new string never needs undoing */
+  if(in->numStrings == in->capacity) {
+    HTNode ** nodes;
+
+    if(in->capacity > INT32_MAX / 2) {
+      return false;
+    }
+
+    nodes = (HTNode**)realloc(in->nodes,
+			      sizeof(HTNode*) * in->capacity * 2);
+    if(nodes == NULL) {
+      return false;
+    }
+    in->nodes = nodes;
+    in->capacity *= 2;
+  }
+
+  value = ht_get_or_insert(in->ht, str, len, &inserted);
+  if(value == NULL) {
+    return false;
+  }
+
+  if(inserted) {
+    value->intVal = in->numStrings;
+    in->nodes[in->numStrings++] = value_node(value);
+  }
+
+  *id = (uint32_t)value->intVal;
+  return true;
+}
+
+/**
+ * Gets the ID of a string without adding it.
+ * in: the interning table instance.
+ * str: the string.
+ * len: the number of bytes in str.
+ * id: receives the ID, if the string has one.
+ * returns: true if the string has been added.
+ */
+bool intern_find(Intern * in, void * str, size_t len, uint32_t * id) {
+  DSValue value;
+
+  if(!ht_get_raw_key(in->ht, str, len, &value)) {
+    return false;
+  }
+
+  *id = (uint32_t)value.intVal;
+  return true;
+}
+
+/**
+ * Gets the string with an ID. O(1), with no hashing.
+ * in: the interning table instance.
+ * id: an ID from intern_add().
+ * len: receives the string's length in bytes, or NULL.
+ * returns: the string, valid until intern_free(), or NULL for an unknown
+ * ID. The string is only null terminated if it was added with its
+ * terminator.
+ */
+void * intern_get(Intern * in, uint32_t id, size_t * len) {
+  HTNode * node;
+
+  if(id >= (uint32_t)in->numStrings) {
+    return NULL;
+  }
+
+  node = in->nodes[id];
+  if(len != NULL) {
+    *len = node->keySize;
+  }
+  return HT_NODE_KEY(node);
+}
+
+/**
+ * Gets the number of strings added, which is also the next ID.
+ */
+int intern_size(Intern * in) {
+  return in->numStrings;
+}
+
+/**
+ * Frees the table and every string in it.
+ * in: the interning table instance.
+ */
+void intern_free(Intern * in) {
+  ht_free(in->ht);
+  free(in->nodes);
+  free(in);
+}
+
+#endif /* DATASTRUCT_ENABLE_INT */
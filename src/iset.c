@@ -0,0 +1,142 @@
+/**
+ * Integer HashSet
+ * (C) 2013 Christian Gunderman
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include "iset.h"
+
+/**
+ * Creates a new instance of integer set.
+ * returns: a new set, or NULL if unable to allocate memory.
+ */
+ISet * iset_new() {
+  ISet * s = calloc(sizeof(ISet), 1);
+
+  if(s != NULL) {
+    s->map = imap_new(16, 0.8f);
+
+    if(s->map == NULL) {
+      free(s);
+      s = NULL;
+    }
+  }
+
+  return s;
+}
+
+/**
+ * Adds the specified value to the set.
+ * s: an instance of integer set.
+ * value: the value to add.
+ * prevValue: a boolean that recv. whether or not value previously
+ * existed within the set. If this value is NULL, it is ignored.
+ * return: false on memory allocation error.
+ */
+bool iset_add(ISet * s, uint64_t value, bool * prevValue) {
+  DSValue newDSValue;
+
+  /* makes no difference what the value is as long as the item is in the
+   * map might as well give it a value though
+   */
+  newDSValue.boolVal = true;
+
+  return imap_put(s->map, value, &newDSValue, NULL, prevValue);
+}
+
+/**
+ * Removes an item from the set.
+ * s: an instance of integer set.
+ * value: the value to remove from the set.
+ * returns: true if the value previously existed in the set.
+ */
+bool iset_remove(ISet * s, uint64_t value) {
+  bool prevValue = false;
+
+  imap_put(s->map, value, NULL, NULL, &prevValue);
+
+  return prevValue;
+}
+
+/**
+ * Checks to see if a value exists in the set.
+ * s: an instance of integer set.
+ * value: the value to check for.
+ * returns: true if the set contains the value in question, and false if
+ * it does not.
+ */
+bool iset_contains(ISet * s, uint64_t value) {
+  return imap_get(s->map, value, NULL);
+}
+
+/**
+ * Gets the number of unique items in the set.
+ * s: an instance of integer set.
+ * returns: the number of items.
+ */
+int iset_size(ISet * s) {
+  return imap_size(s->map);
+}
+
+/**
+ * Grows the set so that numItems values fit without rehashing.
+ * s: an instance of integer set.
+ * numItems: the number of values the set must hold.
+ * returns: false on memory allocation error.
+ */
+bool iset_reserve(ISet * s, int numItems) {
+  return imap_reserve(s->map, numItems);
+}
+
+/**
+ * Gets the iterator for the set.
+ * s: an instance of integer set.
+ * i: A buffer that will receive the set iterator.
+ */
+void iset_iter_get(ISet * s, ISetIter * i) {
+  imap_iter_get(s->map, i);
+}
+
+/**
+ * Determines whether or not the set iterator has iterated through
+ * all items yet.
+ * i: an instance of set iterator.
+ * returns: true if items remain, and false if no items remain.
+ */
+bool iset_iter_has_next(ISetIter * i) {
+  return imap_iter_has_next(i);
+}
+
+/**
+ * Gets the next item in the set.
+ * i: an instance of set iterator.
+ * value: recv. the next value, or NULL.
+ * remove: if true, the value will be removed after it is copied out.
+ * returns: true if an uniterated item was found and written to value.
+ */
+bool iset_iter_next(ISetIter * i, uint64_t * value, bool remove) {
+  return imap_iter_next(i, value, NULL, remove);
+}
+
+/**
+ * Frees a set.
+ * s: an instance of integer set.
+ */
+void iset_free(ISet * s) {
+  imap_free(s->map);
+  free(s);
+}
@@ -33,6 +33,47 @@ LL * ll_new() {
     return NULL;
 }
 
+/**
+ * Creates a new linked list whose nodes are carved from slabs of
+ * nodesPerSlab nodes. Appends and removals then avoid malloc and free,
+ * and ll_free() releases the slabs without visiting each node.
+ * nodesPerSlab: the number of nodes allocated at a time.
+ * returns: new linked list instance, or NULL on malloc error.
+ */
+LL * ll_new_pooled(int nodesPerSlab) {
+  LL * newList = ll_new();
+
+  if(newList != NULL) {
+    newList->pool = pool_new(sizeof(LLNode), nodesPerSlab);
+    if(newList->pool == NULL) {
+      free(newList);
+      return NULL;
+    }
+  }
+  return newList;
+}
+
+/**
+ * Allocates a node from the list's pool, or the heap if it has none.
+ */
+static LLNode * node_alloc(LL * list) {
+  if(list->pool != NULL) {
+    return (LLNode*)pool_alloc(list->pool);
+  }
+  return (LLNode*)malloc(sizeof(LLNode));
+}
+
+/**
+ * Frees a node allocated with node_alloc().
+ */
+static void node_release(LL * list, LLNode * node) {
+  if(list->pool != NULL) {
+    pool_release(list->pool, node);
+  } else {
+    free(node);
+  }
+}
+
 /**
  * Gets the size of the list.
  * list: an instance of linkedlist.
@@ -48,6 +89,13 @@ int ll_size(LL * list) {
 void ll_free(LL * list) {
   LLIter i;
 
+  /* pooled nodes all live in the pool's slabs */
+  if(list->pool != NULL) {
+    pool_free(list->pool);
+    free(list);
+    return;
+  }
+
   /* free all nodes */
   ll_iter_get(&i, list);
   while(ll_iter_has_next(&i)) {
@@ -66,7 +114,7 @@ void ll_free(LL * list) {
  * item: an item to add to the list.
  */
 bool ll_append(LL * list, DSValue item) {
-  LLNode * newNode = (LLNode*)calloc(1, sizeof(LLNode));
+  LLNode * newNode = node_alloc(list);
   if(newNode != NULL) {
     newNode->nextNode = NULL;
     newNode->payload = item;
@@ -296,24 +344,23 @@ DSValue ll_iter_remove(LLIter * i) {
     payload = i->current->payload;
     i->list->size--;
 
-    /* Don't remember what this does....
-     * TODO: figure out what this line is
-     */
-    if(i->list->size != 0) {
-      i->list->tail = NULL;
-    }
-
     if(i->current == i->list->head) {
 
       /* handle if node is head */
       i->list->head = (LLNode*)i->current->nextNode;
+      if(node == i->list->tail) {
+	i->list->tail = NULL;
+      }
     } else {
 
       /* handle if node if not head */
       i->previous->nextNode = i->current->nextNode;
+      if(node == i->list->tail) {
+	i->list->tail = i->previous;
+      }
     }
     i->current = (LLNode*)i->current->nextNode;
-    free(node);
+    node_release(i->list, node);
   }
 
   return payload;
@@ -0,0 +1,427 @@
+/**
+ * LRU Cache
+ * (C) 2013 Christian Gunderman
+ *
+ * A bounded cache with O(1) get, put and evict. Each entry is a single
+ * allocation that is both a hash chain node and a member of a doubly linked
+ * recency list, newest first. A hit finds the node with one lookup and
+ * moves it to the front of the list by relinking it; eviction unlinks the
+ * oldest node from the list and from its bucket. The cache can be limited
+ * by entry count, by bytes, or both.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include "lru.h"
+
+/* Gets a pointer to the key stored after a node */
+#define LRU_NODE_KEY(node) ((void*)((LRUNode*)(node) + 1))
+
+/* number of buckets for caches with no item limit */
+#define LRU_MIN_TABLE_SIZE 16
+
+/* items per bucket at which the table doubles */
+#define LRU_LOAD_FACTOR 0.75
+
+/* most buckets; past this the chains just get longer */
+#define LRU_MAX_TABLE_SIZE (1 << 30)
+
+/**
+ * Rounds n up to a power of two, at most LRU_MAX_TABLE_SIZE.
+ */
+static int round_pow2(double n) {
+  int pow2 = 1;
+
+  while(pow2 < n && pow2 < LRU_MAX_TABLE_SIZE) {
+    pow2 <<= 1;
+  }
+  return pow2;
+}
+
+/**
+ * Gets the bucket of a hash.
+ */
+static LRUNode ** bucket_for_hash(LRU * lru, uint32_t hash) {
+  return &lru->table[hash & (lru->tableSize - 1)];
+}
+
+/**
+ * Finds a key in its bucket.
+ * prevNode: receives the node before the match in the chain, or NULL.
+ * returns: the node, or NULL if the key isn't cached.
+ */
+static LRUNode * find_node(LRU * lru, uint32_t hash, void * key,
+			   size_t keySize, LRUNode ** prevNode) {
+  LRUNode * curNode = *bucket_for_hash(lru, hash);
+
+  *prevNode = NULL;
+
+  while(curNode != NULL) {
+    if(curNode->hash == hash && curNode->keySize == keySize
+       && memcmp(key, LRU_NODE_KEY(curNode), keySize) == 0) {
+      return curNode;
+    }
+
+    *prevNode = curNode;
+    curNode = curNode->next;
+  }
+
+  return NULL;
+}
+
+/**
+ * Removes a node from the recency list.
+ */
+static void list_unlink(LRU * lru, LRUNode * node) {
+  if(node->newer != NULL) {
+    node->newer->older = node->older;
+  } else {
+    lru->newest = node->older;
+  }
+
+  if(node->older != NULL) {
+    node->older->newer = node->newer;
+  } else {
+    lru->oldest = node->newer;
+  }
+}
+
+/**
+ * Adds a node to the front of the recency list.
+ */
+static void list_push_newest(LRU * lru, LRUNode * node) {
+  node->newer = NULL;
+  node->older = lru->newest;
+
+  if(lru->newest != NULL) {
+    lru->newest->newer = node;
+  } else {
+    lru->oldest = node;
+  }
+  lru->newest = node;
+}
+
+/**
+ * Removes a node from its bucket chain.
+ */
+static void chain_unlink(LRU * lru, LRUNode * node) {
+  LRUNode ** link = bucket_for_hash(lru, node->hash);
+
+  while(*link != node) {
+    link = &(*link)->next;
+  }
+  *link = node->next;
+}
+
+/**
+ * Unlinks a node from the cache entirely and frees it.
+ */
+static void node_delete(LRU * lru, LRUNode * node) {
+  chain_unlink(lru, node);
+  list_unlink(lru, node);
+  lru->numItems--;
+  lru->numBytes -= node->size;
+  free(node);
+}
+
+/**
+ * Checks whether the cache is over either of its limits.
+ */
+static bool over_limit(LRU * lru) {
+  return (lru->maxItems > 0 && lru->numItems > lru->maxItems)
+    || (lru->maxBytes > 0 && lru->numBytes > lru->maxBytes);
+}
+
+/**
+ * Drops the oldest entries until the cache is within its limits.
+ */
+static void evict(LRU * lru) {
+  while(over_limit(lru) && lru->oldest != NULL) {
+    LRUNode * node = lru->oldest;
+
+    if(lru->evictFunc != NULL) {
+      lru->evictFunc(LRU_NODE_KEY(node), node->keySize, &node->value,
+		     lru->evictContext);
+    }
+    lru->evictions++;
+    node_delete(lru, node);
+  }
+}
+
+/**
+ * Doubles the bucket array. Stored hashes are reused, so no keys are read.
+ * returns: false on memory allocation error; the cache is left unchanged.
+ */
+static bool grow_table(LRU * lru) {
+  int newSize = lru->tableSize * 2;
+  LRUNode ** newTable = (LRUNode**)calloc(newSize, sizeof(LRUNode*));
+  LRUNode * node;
+
+  if(newTable == NULL) {
+    return false;
+  }
+
+  /* every node is on the recency list, so walk that instead of buckets */
+  for(node = lru->newest; node != NULL; node = node->older) {
+    LRUNode ** bucket = &newTable[node->hash & (newSize - 1)];
+
+    node->next = *bucket;
+    *bucket = node;
+  }
+
+  free(lru->table);
+  lru->table = newTable;
+  lru->tableSize = newSize;
+  return true;
+}
+
+/**
+ * Creates a new LRU cache. When the cache is over either limit, the least
+ * recently used entries are evicted.
+ * maxItems: the most entries to keep, or 0 for no limit. The bucket array
+ * is sized for this many entries up front, up to LRU_MAX_TABLE_SIZE
+ * buckets, so a full cache never rehashes.
+ * maxBytes: the most bytes to keep, or 0 for no limit. Each entry is
+ * charged its node, its key and the valueSize passed to lru_put().
+ * returns: a new LRU, or NULL on memory allocation error.
+ */
+LRU * lru_new(int maxItems, size_t maxBytes) {
+  LRU * lru = (LRU*)calloc(1, sizeof(LRU));
+  int tableSize = LRU_MIN_TABLE_SIZE;
+
+  if(lru == NULL) {
+    return NULL;
+  }
+
+  if(maxItems > 0) {
+    tableSize = round_pow2(maxItems / LRU_LOAD_FACTOR + 1);
+  }
+
+  lru->table = (LRUNode**)calloc(tableSize, sizeof(LRUNode*));
+  if(lru->table == NULL) {
+    free(lru);
+    return NULL;
+  }
+
+  lru->tableSize = tableSize;
+  lru->maxItems = maxItems;
+  lru->maxBytes = maxBytes;
+  lru->hashSeed = hash_random_seed();
+  return lru;
+}
+
+/**
+ * Sets the function called with each entry the cache evicts or frees.
+ * lru: the cache instance.
+ * evictFunc: the callback, or NULL for none.
+ * context: passed through to evictFunc.
+ */
+void lru_set_evict_func(LRU * lru, LRUEvictFunc evictFunc, void * context) {
+  lru->evictFunc = evictFunc;
+  lru->evictContext = context;
+}
+
+/**
+ * Stores a value as the most recently used entry, then evicts the least
+ * recently used entries until the cache is within its limits. An entry
+ * larger than maxBytes on its own is evicted straight away.
+ * lru: the cache instance.
+ * key: the key to store the value under.
+ * keySize: the number of bytes from key that make up the key.
+ * newValue: the value to store.
+ * valueSize: the bytes the value accounts for, eg. the size of the buffer
+ * it points to. Only used when the cache has a byte limit.
+ * oldValue: receives the value replaced, if any. May be NULL.
+ * prevValue: receives whether the key was already cached. May be NULL.
+ * returns: false on memory allocation error.
+ */
+bool lru_put(LRU * lru, void * key, size_t keySize, DSValue * newValue,
+	     size_t valueSize, DSValue * oldValue, bool * prevValue) {
+  uint32_t hash = hash_lookup3(key, keySize, lru->hashSeed);
+  size_t size = sizeof(LRUNode) + keySize + valueSize;
+  LRUNode * prevNode;
+  LRUNode * node = find_node(lru, hash, key, keySize, &prevNode);
+
+  if(prevValue != NULL) {
+    *prevValue = node != NULL;
+  }
+
+  if(node != NULL) {
+    if(oldValue != NULL) {
+      *oldValue = node->value;
+    }
+
+    node->value = *newValue;
+    lru->numBytes += size - node->size;
+    node->size = size;
+    list_unlink(lru, node);
+    list_push_newest(lru, node);
+  } else {
+    LRUNode ** bucket;
+
+    if(lru->numItems + 1 > lru->tableSize * LRU_LOAD_FACTOR
+       && lru->tableSize < LRU_MAX_TABLE_SIZE && !grow_table(lru)) {
+      return false;
+    }
+
+    node = (LRUNode*)malloc(sizeof(LRUNode) + keySize);
+    if(node == NULL) {
+      return false;
+    }
+
+    memcpy(LRU_NODE_KEY(node), key, keySize);
+    node->hash = hash;
+    node->keySize = keySize;
+    node->size = size;
+    node->value = *newValue;
+
+    bucket = bucket_for_hash(lru, hash);
+    node->next = *bucket;
+    *bucket = node;
+    list_push_newest(lru, node);
+    lru->numItems++;
+    lru->numBytes += size;
+  }
+
+  evict(lru);
+  return true;
+}
+
+/**
+ * Gets a value and marks its entry most recently used. Counts a hit or a
+ * miss.
+ * lru: the cache instance.
+ * key: the key to look up.
+ * keySize: the number of bytes from key that make up the key.
+ * value: receives the value. May be NULL.
+ * returns: true if the key is cached.
+ */
+bool lru_get(LRU * lru, void * key, size_t keySize, DSValue * value) {
+  uint32_t hash = hash_lookup3(key, keySize, lru->hashSeed);
+  LRUNode * prevNode;
+  LRUNode * node = find_node(lru, hash, key, keySize, &prevNode);
+
+  if(node == NULL) {
+    lru->misses++;
+    return false;
+  }
+
+  lru->hits++;
+  if(value != NULL) {
+    *value = node->value;
+  }
+
+  if(lru->newest != node) {
+    list_unlink(lru, node);
+    list_push_newest(lru, node);
+  }
+  return true;
+}
+
+/**
+ * Gets a value without marking it used or counting a hit or a miss.
+ * lru: the cache instance.
+ * key: the key to look up.
+ * keySize: the number of bytes from key that make up the key.
+ * value: receives the value. May be NULL.
+ * returns: true if the key is cached.
+ */
+bool lru_peek(LRU * lru, void * key, size_t keySize, DSValue * value) {
+  uint32_t hash = hash_lookup3(key, keySize, lru->hashSeed);
+  LRUNode * prevNode;
+  LRUNode * node = find_node(lru, hash, key, keySize, &prevNode);
+
+  if(node == NULL) {
+    return false;
+  }
+
+  if(value != NULL) {
+    *value = node->value;
+  }
+  return true;
+}
+
+/**
+ * Removes an entry. The evict function is not called.
+ * lru: the cache instance.
+ * key: the key to remove.
+ * keySize: the number of bytes from key that make up the key.
+ * oldValue: receives the removed value. May be NULL.
+ * returns: true if the key was cached.
+ */
+bool lru_remove(LRU * lru, void * key, size_t keySize, DSValue * oldValue) {
+  uint32_t hash = hash_lookup3(key, keySize, lru->hashSeed);
+  LRUNode * prevNode;
+  LRUNode * node = find_node(lru, hash, key, keySize, &prevNode);
+
+  if(node == NULL) {
+    return false;
+  }
+
+  if(oldValue != NULL) {
+    *oldValue = node->value;
+  }
+
+  /* unlink from the chain here, we already have the previous node */
+  if(prevNode != NULL) {
+    prevNode->next = node->next;
+  } else {
+    *bucket_for_hash(lru, hash) = node->next;
+  }
+
+  list_unlink(lru, node);
+  lru->numItems--;
+  lru->numBytes -= node->size;
+  free(node);
+  return true;
+}
+
+/**
+ * Gets the number of cached entries.
+ */
+int lru_size(LRU * lru) {
+  return lru->numItems;
+}
+
+/**
+ * Gets the bytes charged to the cached entries, see lru_new().
+ */
+size_t lru_bytes(LRU * lru) {
+  return lru->numBytes;
+}
+
+/**
+ * Frees the cache, passing each remaining entry to the evict function
+ * first so that values can be released.
+ * lru: the cache instance.
+ */
+void lru_free(LRU * lru) {
+  LRUNode * node = lru->newest;
+
+  while(node != NULL) {
+    LRUNode * older = node->older;
+
+    if(lru->evictFunc != NULL) {
+      lru->evictFunc(LRU_NODE_KEY(node), node->keySize, &node->value,
+		     lru->evictContext);
+    }
+    free(node);
+    node = older;
+  }
+
+  free(lru->table);
+  free(lru);
+}
@@ -0,0 +1,183 @@
+/**
+ * Fixed Size Node Pool
+ * (C) 2013 Christian Gunderman
+ *
+ * Hands out equally sized items from large slabs so that node based
+ * structures don't pay for a malloc/free per node. Released items go on a
+ * free list and are reused before new slab space. Freeing the pool frees
+ * only its slabs, so a structure built on a pool can be torn down without
+ * visiting each node.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include "pool.h"
+
+/* union with the most strictly aligned types items may contain */
+typedef union PoolAlign {
+  void * pointerVal;
+  double doubleVal;
+  long longVal;
+}PoolAlign;
+
+/**
+ * Rounds size up to a multiple of the pool alignment.
+ */
+static size_t pool_align(size_t size) {
+  return (size + sizeof(PoolAlign) - 1) / sizeof(PoolAlign) * sizeof(PoolAlign);
+}
+
+/**
+ * Creates a new pool.
+ * itemSize: the size of every item, in bytes.
+ * itemsPerSlab: the number of items carved from each slab.
+ * returns: a new pool, or NULL if unable to allocate memory.
+ */
+Pool * pool_new(size_t itemSize, int itemsPerSlab) {
+  Pool * pool;
+
+  if(itemsPerSlab < 1) {
+    return NULL;
+  }
+
+  pool = (Pool*)calloc(1, sizeof(Pool));
+  if(pool != NULL) {
+
+    /* items must be able to hold the free list link */
+    pool->itemSize = pool_align(itemSize < sizeof(void*)
+				? sizeof(void*) : itemSize);
+    pool->itemsPerSlab = itemsPerSlab;
+  }
+
+  return pool;
+}
+
+/**
+ * Allocates a slab of count items and adds it to the pool's list.
+ * returns: the slab, or NULL if unable to allocate memory.
+ */
+static PoolSlab * slab_new(Pool * pool, int count) {
+  size_t size = pool_align(sizeof(PoolSlab)) + pool->itemSize * count;
+  PoolSlab * slab = (PoolSlab*)malloc(size);
+
+  if(slab != NULL) {
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->numSlabs++;
+    pool->numBytes += size;
+  }
+
+  return slab;
+}
+
+/**
+ * Allocates a new slab and makes it the source of unused items.
+ * returns: false if unable to allocate memory.
+ */
+static bool pool_grow(Pool * pool) {
+  size_t header = pool_align(sizeof(PoolSlab));
+  PoolSlab * slab = slab_new(pool, pool->itemsPerSlab);
+
+  if(slab == NULL) {
+    return false;
+  }
+
+  pool->unused = (char*)slab + header;
+  pool->unusedEnd = pool->unused + pool->itemSize * pool->itemsPerSlab;
+
+  return true;
+}
+
+/**
+ * Gets an item from the pool. Contents are undefined.
+ * pool: an instance of pool.
+ * returns: a pointer to pool_item_size() bytes, or NULL if unable to
+ * allocate memory.
+ */
+void * pool_alloc(Pool * pool) {
+  void * item;
+
+  /* reuse released items first */
+  if(pool->freeList != NULL) {
+    item = pool->freeList;
+    pool->freeList = *(void**)item;
+    return item;
+  }
+
+  if(pool->unused == pool->unusedEnd && !pool_grow(pool)) {
+    return NULL;
+  }
+
+  item = pool->unused;
+  pool->unused += pool->itemSize;
+  return item;
+}
+
+/**
+ * Allocates count items at once in a slab of their own, for structures
+ * built in bulk. The items are consecutive, pool_item_size() bytes apart,
+ * and are released one at a time with pool_release() like any other.
+ * pool: an instance of pool.
+ * count: the number of items.
+ * returns: the first item, or NULL if unable to allocate memory.
+ */
+void * pool_alloc_block(Pool * pool, int count) {
+  PoolSlab * slab;
+
+  if(count < 1 || (slab = slab_new(pool, count)) == NULL) {
+    return NULL;
+  }
+
+  return (char*)slab + pool_align(sizeof(PoolSlab));
+}
+
+/**
+ * Returns an item to the pool for reuse. Slab memory is only given back to
+ * the system by pool_free().
+ * pool: the pool the item was allocated from.
+ * item: the item to release.
+ */
+void pool_release(Pool * pool, void * item) {
+  *(void**)item = pool->freeList;
+  pool->freeList = item;
+}
+
+/**
+ * Gets the size of the items handed out by the pool, which may be larger
+ * than the size it was created with.
+ * pool: an instance of pool.
+ * returns: the item size, in bytes.
+ */
+size_t pool_item_size(Pool * pool) {
+  return pool->itemSize;
+}
+
+/**
+ * Frees the pool and every item allocated from it.
+ * pool: an instance of pool.
+ */
+void pool_free(Pool * pool) {
+  PoolSlab * slab = pool->slabs;
+
+  while(slab != NULL) {
+    PoolSlab * next = slab->next;
+
+    free(slab);
+    slab = next;
+  }
+
+  free(pool);
+}
@@ -25,11 +25,22 @@
 
 
 /**
- * Creates new dynamically growing string buffer.
+ * Allocates a text block from the buffer's pool, or the heap if it has none.
+ */
+static char * block_alloc(SB * sb) {
+  if(sb->blockPool != NULL) {
+    return (char*)pool_alloc(sb->blockPool);
+  }
+  return (char*)calloc(sb->blockSize, sizeof(char));
+}
+
+/**
+ * Creates the string buffer struct and its first block.
  * blockSize: the number of characters to put in each segment.
- * returns: new string buffer, or NULL if unable to allocate the memory.
+ * blocksPerSlab: blocks and list nodes allocated at a time, or 0 to
+ * allocate them individually.
  */
-SB * sb_new(int blockSize) {
+static SB * sb_create(int blockSize, int blocksPerSlab) {
   SB * sb;
   char * block;
 
@@ -38,31 +49,71 @@ SB * sb_new(int blockSize) {
   if(sb == NULL) {
     return NULL;
   }
+  sb->blockSize = blockSize;
+
+  /* create the block pool */
+  if(blocksPerSlab > 0) {
+    sb->blockPool = pool_new(blockSize, blocksPerSlab);
+    if(sb->blockPool == NULL) {
+      free(sb);
+      return NULL;
+    }
+  }
 
   /* allocate first text block */
-  block = (char*)calloc(blockSize, sizeof(char));
+  block = block_alloc(sb);
   if(block == NULL) {
+    if(sb->blockPool != NULL) {
+      pool_free(sb->blockPool);
+    }
     free(sb);
     return NULL;
   }
 
   /* create linked list */
-  sb->list = ll_new();
+  sb->list = blocksPerSlab > 0 ? ll_new_pooled(blocksPerSlab) : ll_new();
   if(sb->list == NULL) {
+    if(sb->blockPool != NULL) {
+      pool_free(sb->blockPool);
+    } else {
+      free(block);
+    }
     free(sb);
-    free(block);
     return NULL;
   }
 
   /* append first text buffer segment */
   ll_append_pointer(sb->list, block);
-  sb->blockSize = blockSize;
   sb->blockIndex = 0;
   sb->size = 0;
 
   return sb;
 }
 
+/**
+ * Creates new dynamically growing string buffer.
+ * blockSize: the number of characters to put in each segment.
+ * returns: new string buffer, or NULL if unable to allocate the memory.
+ */
+SB * sb_new(int blockSize) {
+  return sb_create(blockSize, 0);
+}
+
+/**
+ * Creates new dynamically growing string buffer whose text blocks and list
+ * nodes are carved from slabs, so that growing the buffer rarely calls
+ * malloc and freeing it releases a few slabs rather than every block.
+ * blockSize: the number of characters to put in each segment.
+ * blocksPerSlab: the number of segments allocated at a time.
+ * returns: new string buffer, or NULL if unable to allocate the memory.
+ */
+SB * sb_new_pooled(int blockSize, int blocksPerSlab) {
+  if(blocksPerSlab < 1) {
+    return NULL;
+  }
+  return sb_create(blockSize, blocksPerSlab);
+}
+
 /**
  * Frees internal linked list of text segments.
  * sb: a stringbuffer instance.
@@ -83,7 +134,13 @@ static void  destroy_list_items(SB * sb) {
  * sb: a string buffer instance
  */
 void sb_free(SB * sb) {
-  destroy_list_items(sb);
+
+  /* pooled blocks all live in the pool's slabs */
+  if(sb->blockPool != NULL) {
+    pool_free(sb->blockPool);
+  } else {
+    destroy_list_items(sb);
+  }
   ll_free(sb->list);
   free(sb);
 }
@@ -99,7 +156,7 @@ void sb_append_char(SB * sb, char c) {
 
   /* current block is full, alloc new one and add to list */
   if(sb->blockIndex == sb->blockSize) {
-    char * newBlock = (char*)calloc(sb->blockSize, sizeof(char));
+    char * newBlock = block_alloc(sb);
     ll_append_pointer(sb->list, newBlock);
     sb->blockIndex = 0;
   }
@@ -138,8 +195,9 @@ void sb_append_str(SB * sb, char * string, size_t length) {
  */
 SB * sb_reset(SB * sb) {
   int blockSize = sb->blockSize;
+  int blocksPerSlab = sb->blockPool != NULL ? sb->blockPool->itemsPerSlab : 0;
   sb_free(sb);
-  return sb_new(blockSize);
+  return sb_create(blockSize, blocksPerSlab);
 }
 
 /**
@@ -29,7 +29,34 @@ Set * set_new() {
   Set * s = calloc(sizeof(Set), 1);
 
   if(s != NULL) {
-    s->ht = ht_new(10, 10, 0.8f);
+    s->ht = ht_new(16, 16, 0.8f);
+
+    if(s->ht == NULL) {
+      free(s);
+      s = NULL;
+    }
+  }
+
+  return s;
+}
+
+/**
+ * Creates a set holding count values from an array, building it in bulk,
+ * see ht_from_arrays(). Faster than set_new() and count set_add() calls.
+ * values: array of count pointers to values.
+ * valueLens: array of count value lengths, in bytes.
+ * count: the number of values. Duplicates are stored once.
+ * numThreads: the most threads to build with, 1 for the calling thread
+ * only. Ignored without DATASTRUCT_ENABLE_THREADS.
+ * returns: a new set, or NULL on memory allocation error.
+ */
+Set * set_from_array(void ** values, size_t * valueLens, int count,
+		     int numThreads) {
+  Set * s = calloc(sizeof(Set), 1);
+
+  if(s != NULL) {
+    s->ht = ht_from_arrays(values, valueLens, NULL, count, 0.8f, NULL,
+			   numThreads);
 
     if(s->ht == NULL) {
       free(s);
@@ -95,6 +122,33 @@ bool set_contains(Set * s, void * value, size_t valueLen) {
   return ht_get_raw_key(s->ht, value, valueLen, &oldDSValue);
 }
 
+/**
+ * Computes a value's hash the way this set does, for set_contains_hashed().
+ * s: an instance of set.
+ * value: the value to hash.
+ * valueLen: the number of bytes from value buffer to treat as the value.
+ * returns: the value's hash.
+ */
+uint32_t set_hash(Set * s, void * value, size_t valueLen) {
+  return ht_hash(s->ht, value, valueLen);
+}
+
+/**
+ * Checks to see if a value exists in the set, given its hash.
+ * s: an instance of set.
+ * hash: the value's hash, from set_hash().
+ * value: the value to check for.
+ * valueLen: the number of bytes from value buffer to treat as the value.
+ * returns: true if the set contains the value in question, and false if
+ * it does not.
+ */
+bool set_contains_hashed(Set * s, uint32_t hash, void * value,
+			 size_t valueLen) {
+  DSValue oldDSValue;
+
+  return ht_get_hashed(s->ht, hash, value, valueLen, &oldDSValue);
+}
+
 /**
  * Gets the number of unique items in the set.
  * s: an instance of set
@@ -104,6 +158,56 @@ int set_size(Set * s) {
   return ht_size(s->ht);
 }
 
+/**
+ * Grows the set so that numItems values fit without rehashing. Call before
+ * adding a large number of values.
+ * s: an instance of set.
+ * numItems: the number of values the set must hold.
+ * returns: false on memory allocation error.
+ */
+bool set_reserve(Set * s, int numItems) {
+  return ht_reserve(s->ht, numItems);
+}
+
+/**
+ * Shrinks the set to fit its values and repacks them, see ht_compact().
+ * s: an instance of set.
+ * returns: false on memory allocation error.
+ */
+bool set_compact(Set * s) {
+  return ht_compact(s->ht);
+}
+
+/**
+ * Makes the set immutable, indexed by a perfect hash, see ht_freeze().
+ * set_add() and set_remove() fail afterwards.
+ * s: an instance of set.
+ * returns: false on memory allocation error.
+ */
+bool set_freeze(Set * s) {
+  return ht_freeze(s->ht);
+}
+
+/**
+ * Gets the set's statistics. See ht_stats().
+ * s: an instance of set.
+ * stats: receives the statistics.
+ * returns: false if the library was built without DATASTRUCT_ENABLE_STATS.
+ */
+bool set_stats(Set * s, HTStats * stats) {
+  return ht_stats(s->ht, stats);
+}
+
+/**
+ * Writes the set's statistics to a file as JSON. See ht_stats_dump().
+ * s: an instance of set.
+ * file: the file to write to.
+ * returns: false if stats are compiled out or the write fails.
+ */
+bool set_stats_dump(Set * s, FILE * file) {
+  return ht_stats_dump(s->ht, file);
+}
+
 /**
  * Gets the iterator for the set.
  *
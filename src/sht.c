@@ -0,0 +1,404 @@
+/**
+ * Sharded HashTable
+ * (C) 2013 Christian Gunderman
+ *
+ * A thread safe table made of numShards independent HTs, each behind its
+ * own mutex. A key's shard is picked by the high bits of its hash, and the
+ * shard's HT is handed the same hash, whose low bits pick the bucket, so
+ * keys are hashed once. Each shard grows, shrinks and rehashes on its own,
+ * so a resize only stalls the threads using that shard, and only moves
+ * 1 / numShards of the items.
+ *
+ * sht_for_each_shard() runs a callback on every shard from a pool of
+ * worker threads, for maintenance passes such as ht_compact(), ht_save()
+ * of each shard, or evicting items, that would otherwise walk the whole
+ * table on one thread.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+/* pthread is not visible in strict C89 mode without this */
+#define _XOPEN_SOURCE 600
+
+#include <pthread.h>
+#include "sht.h"
+
+/* shards are padded to this many bytes so they don't share cache lines */
+#define SHT_CACHE_LINE 64
+
+/* most worker threads sht_for_each_shard() will start */
+#define SHT_MAX_THREADS 64
+
+/* per-shard state */
+typedef struct SHTShard {
+  pthread_mutex_t lock;
+  HT * ht;
+  long numItems;       /* ht's size, readable without the lock */
+} SHTShard;
+
+/* state shared by the workers of one sht_for_each_shard() call */
+typedef struct SHTWork {
+  SHT * sht;
+  SHTShardFunc func;
+  void * context;
+  int nextShard;
+  int failed;
+} SHTWork;
+
+/* Relaxed atomic access to the shard counters and the work queue, which
+ * are shared between threads without a lock.
+ */
+#ifdef __GNUC__
+#define COUNT_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define COUNT_STORE(p, n) __atomic_store_n((p), (n), __ATOMIC_RELAXED)
+#define COUNT_ADD(p, n) __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+#else
+#define COUNT_LOAD(p) (*(volatile long *)(p))
+#define COUNT_STORE(p, n) (*(p) = (n))
+#define COUNT_ADD(p, n) ((*(p) += (n)) - (n))
+#endif /* __GNUC__ */
+
+/**
+ * Gets the size of a padded shard.
+ */
+static size_t shard_stride() {
+  return (sizeof(SHTShard) + SHT_CACHE_LINE - 1)
+    / SHT_CACHE_LINE * SHT_CACHE_LINE;
+}
+
+/**
+ * Gets shard n.
+ */
+static SHTShard * get_shard(SHT * sht, int n) {
+  return (SHTShard*)((char*)sht->shards + shard_stride() * n);
+}
+
+/**
+ * Gets the shard of a hash, from its high bits.
+ */
+static SHTShard * shard_for_hash(SHT * sht, uint32_t hash) {
+  if(sht->numShards == 1) {
+    return get_shard(sht, 0);
+  }
+  return get_shard(sht, (int)(hash >> sht->shardShift));
+}
+
+/**
+ * Creates a new sharded hashtable.
+ * numShards: number of independent tables, rounded up to a power of two.
+ * A few times the number of threads is typical.
+ * tableSize: initial number of buckets, split evenly between the shards.
+ * blockSize: passed to each shard, see ht_new().
+ * loadFactor: passed to each shard, see ht_new().
+ * options: passed to each shard, see ht_new_ex(), or NULL for the
+ * defaults. options->ebr must not be set. If options->randomSeed is set,
+ * one seed is picked and shared by every shard.
+ * returns: a new SHT, or NULL on memory allocation error or unsupported
+ * options.
+ */
+SHT * sht_new(int numShards, int tableSize, int blockSize, float loadFactor,
+	      HTOptions * options) {
+  SHT * sht = (SHT*)calloc(1, sizeof(SHT));
+  HTOptions shardOptions;
+  int n;
+
+  if(sht == NULL) {
+    return NULL;
+  }
+
+  if(options != NULL) {
+    memcpy(&shardOptions, options, sizeof(HTOptions));
+  } else {
+    ht_options_init(&shardOptions);
+  }
+
+  /* shard locks already serialize readers with writers */
+  if(shardOptions.ebr != NULL) {
+    free(sht);
+    return NULL;
+  }
+
+  /* every shard must hash keys exactly as the router does */
+  if(shardOptions.hashFunc == NULL) {
+    shardOptions.hashFunc = hash_lookup3;
+  }
+  if(shardOptions.randomSeed) {
+    shardOptions.hashSeed = hash_random_seed();
+    shardOptions.randomSeed = false;
+  }
+  sht->hashFunc = shardOptions.hashFunc;
+  sht->hashSeed = shardOptions.hashSeed;
+
+  sht->numShards = 1;
+  sht->shardShift = 32;
+  while(sht->numShards < numShards) {
+    sht->numShards <<= 1;
+    sht->shardShift--;
+  }
+
+  tableSize /= sht->numShards;
+  if(tableSize < 1) {
+    tableSize = 1;
+  }
+
+  sht->shards = calloc(sht->numShards, shard_stride());
+  if(sht->shards == NULL) {
+    free(sht);
+    return NULL;
+  }
+
+  for(n = 0; n < sht->numShards; n++) {
+    SHTShard * shard = get_shard(sht, n);
+
+    shard->ht = ht_new_ex(tableSize, blockSize, loadFactor, &shardOptions);
+    if(shard->ht == NULL) {
+      while(n-- > 0) {
+	ht_free(get_shard(sht, n)->ht);
+	pthread_mutex_destroy(&get_shard(sht, n)->lock);
+      }
+      free(sht->shards);
+      free(sht);
+      return NULL;
+    }
+    pthread_mutex_init(&shard->lock, NULL);
+  }
+
+  return sht;
+}
+
+/**
+ * Stores a value. Safe to call from any thread. Same contract as
+ * ht_put_raw_key().
+ * sht: the sharded hashtable instance.
+ * key: the key which the value will be hashed to.
+ * keySize: The number of bytes from key that will be used for the key.
+ * newValue: A pointer to a new value to store. If this value is NULL, the
+ * item at the specified key is removed.
+ * oldValue: A buffer that will recv. the old value, or NULL.
+ * prevValue: recv. whether or not the key previously had a value, or NULL.
+ * return: true on success, or false on memory allocation error.
+ */
+bool sht_put(SHT * sht, void * key, size_t keySize,
+	     DSValue * newValue, DSValue * oldValue, bool * prevValue) {
+  uint32_t hash = sht->hashFunc(key, keySize, sht->hashSeed);
+  SHTShard * shard = shard_for_hash(sht, hash);
+  bool success;
+
+  pthread_mutex_lock(&shard->lock);
+  success = ht_put_hashed(shard->ht, hash, key, keySize, newValue, oldValue,
+			  prevValue);
+  COUNT_STORE(&shard->numItems, (long)ht_size(shard->ht));
+  pthread_mutex_unlock(&shard->lock);
+
+  return success;
+}
+
+/**
+ * Gets a value. Safe to call from any thread. Same contract as
+ * ht_get_raw_key().
+ * sht: the sharded hashtable instance.
+ * key: the key at which the value will be looked up.
+ * keySize: the number of bytes from key to be used as the key.
+ * value: recv. the stored value if it exists, or NULL.
+ * returns: true if the specified value exists and false if it does not.
+ */
+bool sht_get(SHT * sht, void * key, size_t keySize, DSValue * value) {
+  uint32_t hash = sht->hashFunc(key, keySize, sht->hashSeed);
+  SHTShard * shard = shard_for_hash(sht, hash);
+  bool exists;
+
+  /* a mutex rather than a read lock, since gets on an incrementally
+   * rehashing HT move buckets
+   */
+  pthread_mutex_lock(&shard->lock);
+  exists = ht_get_hashed(shard->ht, hash, key, keySize, value);
+  pthread_mutex_unlock(&shard->lock);
+
+  return exists;
+}
+
+/**
+ * Removes a value. Safe to call from any thread.
+ * sht: the sharded hashtable instance.
+ * key: the key to remove.
+ * keySize: the number of bytes from key to be used as the key.
+ * oldValue: recv. the removed value, or NULL.
+ * returns: true if the key existed.
+ */
+bool sht_remove(SHT * sht, void * key, size_t keySize, DSValue * oldValue) {
+  bool prevValue = false;
+
+  sht_put(sht, key, keySize, NULL, oldValue, &prevValue);
+  return prevValue;
+}
+
+/**
+ * Gets the number of items in the table. Takes no locks; while other
+ * threads are writing the result is a recent, not an exact, count.
+ * sht: the sharded hashtable instance.
+ * returns: the number of items.
+ */
+int sht_size(SHT * sht) {
+  long numItems = 0;
+  int n;
+
+  for(n = 0; n < sht->numShards; n++) {
+    numItems += COUNT_LOAD(&get_shard(sht, n)->numItems);
+  }
+  return (int)numItems;
+}
+
+/**
+ * Takes shards off of the shared queue and runs the callback on each, until
+ * none are left.
+ */
+static void * shard_worker(void * arg) {
+  SHTWork * work = (SHTWork*)arg;
+  SHT * sht = work->sht;
+  int n;
+
+  while((n = COUNT_ADD(&work->nextShard, 1)) < sht->numShards) {
+    SHTShard * shard = get_shard(sht, n);
+
+    pthread_mutex_lock(&shard->lock);
+    if(!work->func(shard->ht, n, work->context)) {
+      COUNT_STORE(&work->failed, 1);
+    }
+    COUNT_STORE(&shard->numItems, (long)ht_size(shard->ht));
+    pthread_mutex_unlock(&shard->lock);
+  }
+
+  return NULL;
+}
+
+/**
+ * Runs a callback on every shard, spreading the shards over up to
+ * numThreads threads, the calling thread included. Each shard is locked
+ * while its callback runs, so other threads can keep using the shards that
+ * aren't being worked on. Returns once every callback has finished.
+ * sht: the sharded hashtable instance.
+ * func: the callback.
+ * context: passed to every call of func.
+ * numThreads: the most threads to use. 1 or less runs every callback on
+ * the calling thread. If threads can't be started, the rest do the work.
+ * returns: false if any callback returned false.
+ */
+bool sht_for_each_shard(SHT * sht, SHTShardFunc func, void * context,
+			int numThreads) {
+  pthread_t threads[SHT_MAX_THREADS];
+  SHTWork work;
+  int started = 0;
+  int n;
+
+  work.sht = sht;
+  work.func = func;
+  work.context = context;
+  work.nextShard = 0;
+  work.failed = 0;
+
+  if(numThreads > sht->numShards) {
+    numThreads = sht->numShards;
+  }
+  if(numThreads > SHT_MAX_THREADS) {
+    numThreads = SHT_MAX_THREADS;
+  }
+
+  /* the calling thread is one of the workers */
+  for(n = 1; n < numThreads; n++) {
+    if(pthread_create(&threads[started], NULL, shard_worker, &work) == 0) {
+      started++;
+    }
+  }
+
+  shard_worker(&work);
+
+  for(n = 0; n < started; n++) {
+    pthread_join(threads[n], NULL);
+  }
+
+  return !work.failed;
+}
+
+/**
+ * Gets an iterator over every shard, one shard after another. Takes no
+ * locks, so no other thread may write to the table while iterating.
+ * sht: the sharded hashtable instance.
+ * i: A pointer to a buffer that will recv. the iterator.
+ */
+void sht_iter_get(SHT * sht, SHTIter * i) {
+  i->instance = sht;
+  i->shard = 0;
+  ht_iter_get(get_shard(sht, 0)->ht, &i->iter);
+}
+
+/**
+ * Checks the iterator for items that have not been iterated over yet,
+ * moving on to the next shard when the current one runs out.
+ * i: an iterator.
+ * returns: true if items remain, and false if no items remain.
+ */
+bool sht_iter_has_next(SHTIter * i) {
+  SHT * sht = i->instance;
+
+  while(!ht_iter_has_next(&i->iter)) {
+    SHTShard * shard = get_shard(sht, i->shard);
+
+    /* pick up removals made through the iterator */
+    COUNT_STORE(&shard->numItems, (long)ht_size(shard->ht));
+
+    if(i->shard + 1 >= sht->numShards) {
+      return false;
+    }
+    i->shard++;
+    ht_iter_get(get_shard(sht, i->shard)->ht, &i->iter);
+  }
+
+  return true;
+}
+
+/**
+ * Gets the next item. Same as ht_iter_next().
+ * i: an iterator.
+ * returns: true if an uniterated item was found and written to the buffers.
+ */
+bool sht_iter_next(SHTIter * i, void * keyBuffer, size_t keyBufferLen,
+		   DSValue * value, size_t * keyLen, bool remove) {
+  if(!sht_iter_has_next(i)) {
+    return false;
+  }
+
+  return ht_iter_next(&i->iter, keyBuffer, keyBufferLen, value, keyLen,
+		      remove);
+}
+
+/**
+ * Frees every shard. No other thread may be using the table. Pointers
+ * stored as values are not freed.
+ * sht: the sharded hashtable instance.
+ */
+void sht_free(SHT * sht) {
+  int n;
+
+  for(n = 0; n < sht->numShards; n++) {
+    SHTShard * shard = get_shard(sht, n);
+
+    ht_free(shard->ht);
+    pthread_mutex_destroy(&shard->lock);
+  }
+
+  free(sht->shards);
+  free(sht);
+}
@@ -0,0 +1,307 @@
+/**
+ * Hierarchical Timer Wheel
+ * (C) 2013 Christian Gunderman
+ *
+ * Hashed hierarchical timing wheels, after Varghese and Lauck. Level 0 has
+ * one slot per tick; each slot of level n covers a whole turn of level
+ * n - 1. A timer goes in the lowest level whose span reaches its expiry,
+ * in the slot its expiry hashes to, so scheduling is an append to one
+ * list. When a level completes a turn, the next slot of the level above
+ * is emptied and its timers are placed again, now in lower levels
+ * (cascading). A tick therefore costs the timers it fires plus, once per
+ * turn, one cascade, however many timers are outstanding.
+ *
+ * Slots are singly linked lists, so a timer can't be unlinked in O(1).
+ * Cancelling only marks it, and the marked timer is released when its slot
+ * is next fired or cascaded.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Contact Email: gundermanc@gmail.com
+ */
+
+#include "tw.h"
+
+#ifdef DATASTRUCT_ENABLE_POINTER
+
+/* list nodes and timers allocated at a time */
+#define TW_ITEMS_PER_SLAB 1024
+
+/**
+ * Gets the slot of a timer's expiry at a level.
+ */
+static LL * level_slot(TW * tw, int level, uint64_t tick) {
+  return &tw->slots[level][(tick >> (level * TW_SLOT_BITS)) & (TW_SLOTS - 1)];
+}
+
+/**
+ * Adds a timer to the slot for its expiry, in the lowest level that
+ * reaches it.
+ * returns: false on memory allocation error.
+ */
+static bool place_timer(TW * tw, TWTimer * timer) {
+  uint64_t delta = timer->expires - tw->currentTick;
+  int level = 0;
+
+  while(level < TW_LEVELS - 1
+	&& delta >= (uint64_t)1 << ((level + 1) * TW_SLOT_BITS)) {
+    level++;
+  }
+
+  if(!ll_append_pointer(level_slot(tw, level, timer->expires), timer)) {
+    return false;
+  }
+
+  tw->levelNodes[level]++;
+  return true;
+}
+
+/**
+ * Takes all nodes from a slot, leaving it empty, so that timers placed
+ * while the nodes are processed can't land in the list being walked.
+ */
+static void detach_slot(TW * tw, int level, LL * slot, LL * detached) {
+  tw->levelNodes[level] -= slot->size;
+  *detached = *slot;
+  slot->head = NULL;
+  slot->tail = NULL;
+  slot->size = 0;
+}
+
+/**
+ * Places each timer of a higher level slot again, dropping cancelled ones.
+ * Timers whose list node can't be allocated fire early instead of being
+ * lost.
+ */
+static void cascade(TW * tw, int level) {
+  LL detached;
+  LLIter i;
+
+  detach_slot(tw, level, level_slot(tw, level, tw->currentTick), &detached);
+  ll_iter_get(&i, &detached);
+
+  while(ll_iter_has_next(&i)) {
+    TWTimer * timer = (TWTimer*)ll_iter_remove(&i).pointerVal;
+
+    if(timer->cancelled) {
+      pool_release(tw->timerPool, timer);
+    } else if(!place_timer(tw, timer)) {
+      timer->expires = tw->currentTick;
+      tw->numTimers--;
+      timer->func(tw, timer->context);
+      pool_release(tw->timerPool, timer);
+    }
+  }
+}
+
+/**
+ * Fires the timers of the current tick's level 0 slot.
+ * returns: the number of timers fired.
+ */
+static int fire_slot(TW * tw) {
+  LL detached;
+  LLIter i;
+  int numFired = 0;
+
+  detach_slot(tw, 0, level_slot(tw, 0, tw->currentTick), &detached);
+  ll_iter_get(&i, &detached);
+
+  while(ll_iter_has_next(&i)) {
+    TWTimer * timer = (TWTimer*)ll_iter_remove(&i).pointerVal;
+
+    if(!timer->cancelled) {
+      tw->numTimers--;
+      timer->func(tw, timer->context);
+      numFired++;
+    }
+    pool_release(tw->timerPool, timer);
+  }
+
+  return numFired;
+}
+
+/**
+ * Gets the furthest tick, up to target, that the wheel can jump to without
+ * missing anything. While the lowest levels are empty, nothing happens
+ * until the lowest occupied level next cascades.
+ */
+static uint64_t skip_to(TW * tw, uint64_t target) {
+  uint64_t skip;
+  int level = 0;
+
+  while(level < TW_LEVELS - 1 && tw->levelNodes[level] == 0) {
+    level++;
+  }
+
+  /* the tick before the lowest occupied level's next cascade */
+  skip = tw->currentTick | (((uint64_t)1 << (level * TW_SLOT_BITS)) - 1);
+  return skip < target ? skip : target;
+}
+
+/**
+ * Creates a new timer wheel.
+ * resolution: the time units per tick, eg. 10 for 10ms ticks when times
+ * are in milliseconds. Deadlines are rounded up to whole ticks, so timers
+ * never fire early.
+ * now: the current time, in whatever units the caller uses.
+ * returns: a new TW, or NULL on memory allocation error.
+ */
+TW * tw_new(uint64_t resolution, uint64_t now) {
+  TW * tw = (TW*)calloc(1, sizeof(TW));
+  int level;
+  int n;
+
+  if(tw == NULL) {
+    return NULL;
+  }
+
+  tw->nodePool = pool_new(sizeof(LLNode), TW_ITEMS_PER_SLAB);
+  tw->timerPool = pool_new(sizeof(TWTimer), TW_ITEMS_PER_SLAB);
+  if(tw->nodePool == NULL || tw->timerPool == NULL) {
+    if(tw->nodePool != NULL) {
+      pool_free(tw->nodePool);
+    }
+    if(tw->timerPool != NULL) {
+      pool_free(tw->timerPool);
+    }
+    free(tw);
+    return NULL;
+  }
+
+  /* every slot draws its nodes from the one pool */
+  for(level = 0; level < TW_LEVELS; level++) {
+    for(n = 0; n < TW_SLOTS; n++) {
+      tw->slots[level][n].pool = tw->nodePool;
+    }
+  }
+
+  tw->resolution = resolution > 0 ? resolution : 1;
+  tw->currentTick = now / tw->resolution;
+  return tw;
+}
+
+/**
+ * Schedules a function to be called by the first tw_advance() to reach
+ * the deadline. O(1).
+ * tw: the timer wheel instance.
+ * deadline: the time to fire at, in the units passed to tw_new(). A
+ * deadline that has already passed fires on the next tick.
+ * func: the function to call.
+ * context: passed through to func.
+ * returns: the timer, which can be passed to tw_cancel() until func is
+ * called, or NULL on memory allocation error.
+ */
+TWTimer * tw_schedule(TW * tw, uint64_t deadline, TWTimerFunc func,
+		      void * context) {
+  TWTimer * timer = (TWTimer*)pool_alloc(tw->timerPool);
+  uint64_t tick = deadline / tw->resolution
+    + (deadline % tw->resolution != 0);
+
+  if(timer == NULL) {
+    return NULL;
+  }
+
+  timer->expires = tick > tw->currentTick ? tick : tw->currentTick + 1;
+  timer->func = func;
+  timer->context = context;
+  timer->cancelled = false;
+
+  if(!place_timer(tw, timer)) {
+    pool_release(tw->timerPool, timer);
+    return NULL;
+  }
+
+  tw->numTimers++;
+  return timer;
+}
+
+/**
+ * Cancels a timer. O(1): the timer's memory is reclaimed when the wheel
+ * next passes its slot. Cancelling a cancelled timer does nothing.
+ * tw: the timer wheel instance.
+ * timer: a timer from tw_schedule() whose function hasn't been called.
+ */
+void tw_cancel(TW * tw, TWTimer * timer) {
+  if(!timer->cancelled) {
+    timer->cancelled = true;
+    tw->numTimers--;
+  }
+}
+
+/**
+ * Moves the wheel forward to now, firing every timer whose deadline has
+ * been reached, tick by tick in order. Call it as often as the resolution
+ * requires. A call covering many ticks processes them in one batch,
+ * jumping over stretches in which the lower levels are empty, and an empty
+ * wheel skips straight to now.
+ * tw: the timer wheel instance.
+ * now: the current time. Times before the wheel's current tick are
+ * ignored.
+ * returns: the number of timers fired.
+ */
+int tw_advance(TW * tw, uint64_t now) {
+  uint64_t target = now / tw->resolution;
+  int numFired = 0;
+
+  while(tw->currentTick < target) {
+    int level;
+
+    if(tw->numTimers == 0) {
+      tw->currentTick = target;
+      break;
+    }
+
+    /* pass over the ticks where no slot has anything in it */
+    tw->currentTick = skip_to(tw, target);
+    if(tw->currentTick == target) {
+      break;
+    }
+
+    tw->currentTick++;
+
+    /* each level that completed a turn pulls in the next slot above */
+    for(level = 1; level < TW_LEVELS; level++) {
+      uint64_t lowerTicks = tw->currentTick
+	& (((uint64_t)1 << (level * TW_SLOT_BITS)) - 1);
+
+      if(lowerTicks != 0) {
+	break;
+      }
+      cascade(tw, level);
+    }
+
+    numFired += fire_slot(tw);
+  }
+
+  return numFired;
+}
+
+/**
+ * Gets the number of timers scheduled and not yet fired or cancelled.
+ */
+int tw_size(TW * tw) {
+  return tw->numTimers;
+}
+
+/**
+ * Frees the wheel and all its timers, without calling their functions.
+ * tw: the timer wheel instance.
+ */
+void tw_free(TW * tw) {
+  pool_free(tw->nodePool);
+  pool_free(tw->timerPool);
+  free(tw);
+}
+
+#endif /* DATASTRUCT_ENABLE_POINTER */